@@ -0,0 +1,109 @@
+#
+# benchmarks.jl --
+#
+# Benchmark suite for XPA.jl.  To run the benchmarks and compare the results
+# between two commits (e.g. `master` and the current working tree):
+#
+#     using PkgBenchmark, XPA
+#     results = benchmarkpkg(XPA)
+#     judge(XPA, "master")
+#
+# An XPA name server (`xpans`) must be running or be able to be started.
+# Environment variables `XPA_BENCH_MAXSIZE` (2^28 bytes by default) and
+# `XPA_BENCH_NAPTS` (100 by default) can be set to specify the maximum size of
+# the data transfered and the number of extra access points registered to
+# measure the cost of `XPA.find` and `XPA.list`.  The server is run in the
+# Julia project given by `XPA_BENCH_PROJECT` (this directory by default).
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+module XPABenchmarks
+
+using BenchmarkTools, XPA
+
+const MAXSIZE = parse(Int, get(ENV, "XPA_BENCH_MAXSIZE", string(2^28)))
+const NAPTS = parse(Int, get(ENV, "XPA_BENCH_NAPTS", "100"))
+const PROJECT = get(ENV, "XPA_BENCH_PROJECT", @__DIR__)
+const SERVER = joinpath(@__DIR__, "server.jl")
+
+# Start a server in a separate process and wait until it is registered.
+function start_server(napts::Integer; timeout::Real = 30)
+    cmd = `$(Base.julia_cmd()) --project=$PROJECT $SERVER $napts`
+    proc = run(pipeline(cmd; stdout=devnull, stderr=stderr); wait=false)
+    t0 = time()
+    while XPA.find("BENCH:main"; cache=false) === nothing
+        process_running(proc) || error("benchmark server failed to start")
+        time() - t0 < timeout || (kill(proc); error("timeout for server"))
+        sleep(0.1)
+    end
+    return proc
+end
+
+function stop_server(proc)
+    try
+        XPA.set("BENCH:main", "quit")
+    catch
+    end
+    wait(proc)
+end
+
+const PROC = start_server(NAPTS)
+atexit(() -> stop_server(PROC))
+const ADDR = XPA.address("BENCH:main")
+
+const SUITE = BenchmarkGroup()
+
+# Latency of requests with no data.
+SUITE["latency"] = BenchmarkGroup()
+SUITE["latency"]["get"] = @benchmarkable XPA.get(length, $ADDR, "null")
+SUITE["latency"]["set"] = @benchmarkable XPA.set(length, $ADDR, "null")
+SUITE["latency"]["get by name"] =
+    @benchmarkable XPA.get(length, "BENCH:main", "null")
+SUITE["latency"]["get (new connection)"] =
+    @benchmarkable XPA.get(length, XPA.Client(C_NULL), $ADDR, "null")
+SUITE["latency"]["get_async"] =
+    @benchmarkable fetch(XPA.get_async($ADDR, "null"))
+
+# Throughput versus the size of the data.
+SUITE["get"] = BenchmarkGroup()
+SUITE["set"] = BenchmarkGroup()
+let n = 1
+    while n ≤ MAXSIZE
+        data = rand(UInt8, n)
+        SUITE["get"][n] = @benchmarkable XPA.get(Vector{UInt8}, $ADDR, "bytes", $n)
+        SUITE["get"][(n, "io")] = @benchmarkable(
+            XPA.get(length, io, $ADDR, "bytes", $n),
+            setup = (io = open(tempname(), "w+")),
+            teardown = close(io))
+        SUITE["set"][n] = @benchmarkable XPA.set(length, $ADDR, "bytes";
+                                                 data = $data)
+        n *= 16
+    end
+end
+
+# Cost of querying the name server.
+SUITE["names"] = BenchmarkGroup()
+SUITE["names"]["list"] = @benchmarkable XPA.list()
+SUITE["names"]["find"] =
+    @benchmarkable XPA.find("BENCH:apt$($NAPTS)"; cache=false)
+SUITE["names"]["find (cached)"] = @benchmarkable XPA.find("BENCH:apt$($NAPTS)")
+SUITE["names"]["address"] = @benchmarkable XPA.address("BENCH:main")
+
+# Scaling of concurrent requests (the number of Julia threads is given by
+# `JULIA_NUM_THREADS`).
+SUITE["concurrency"] = BenchmarkGroup()
+for n in (1, 2, 4, 8, 16)
+    apts = fill(ADDR, n)
+    SUITE["concurrency"][("getmany", n)] =
+        @benchmarkable foreach(XPA.release!, XPA.getmany($apts, "null"))
+    SUITE["concurrency"][("get_async", n)] =
+        @benchmarkable foreach(XPA.release! ∘ fetch,
+                               [XPA.get_async(apt, "null") for apt in $apts])
+end
+
+end # module
+
+const SUITE = XPABenchmarks.SUITE
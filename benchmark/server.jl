@@ -0,0 +1,72 @@
+#
+# server.jl --
+#
+# XPA servers for benchmarking XPA.jl, run in a separate process by
+# `benchmarks.jl`:
+#
+#     julia --project=benchmark benchmark/server.jl [NAPTS [NAME]]
+#
+# creates access point `BENCH:NAME` (`BENCH:main` by default) and `NAPTS` (0 by
+# default) other access points `BENCH:aptN` to populate the name server.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+module XPABenchServer
+
+using XPA
+
+# Bytes served by `XPA.get(apt, "bytes", n)`, shared to avoid measuring the
+# cost of building the answer.
+const PAYLOADS = Dict{Int,Vector{UInt8}}()
+
+function send(running::Base.RefValue{Bool}, srv::XPA.Server, params::String,
+              buf::XPA.SendBuffer)
+    try
+        args = split(params)
+        if isempty(args) || args[1] == "null"
+            return XPA.SUCCESS
+        elseif args[1] == "bytes" && length(args) == 2
+            n = parse(Int, args[2])
+            XPA.store!(buf, get!(() -> rand(UInt8, n), PAYLOADS, n);
+                       share=true)
+            return XPA.SUCCESS
+        end
+        return error(srv, "unknown command \"$params\"")
+    catch err
+        return error(srv, sprint(showerror, err))
+    end
+end
+
+function recv(running::Base.RefValue{Bool}, srv::XPA.Server, params::String,
+              buf::XPA.ReceiveBuffer)
+    if params == "quit"
+        running[] = false
+    end
+    return XPA.SUCCESS
+end
+
+function main(napts::Integer = 0, name::AbstractString = "main")
+    running = Ref(true)
+    servers = [XPA.Server("BENCH", name, "benchmark server",
+                          XPA.SendCallback(send, running),
+                          XPA.ReceiveCallback(recv, running))]
+    for i in 1:napts
+        push!(servers, XPA.Server("BENCH", "apt$i", "benchmark server",
+                                  XPA.SendCallback(send, running),
+                                  XPA.ReceiveCallback(recv, running)))
+    end
+    while running[]
+        XPA.poll(-1, 1)
+    end
+    foreach(close, servers)
+end
+
+end # module
+
+if abspath(PROGRAM_FILE) == @__FILE__
+    XPABenchServer.main((length(ARGS) ≥ 1 ? parse(Int, ARGS[1]) : 0),
+                        (length(ARGS) ≥ 2 ? ARGS[2] : "main"))
+end
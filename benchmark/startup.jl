@@ -0,0 +1,93 @@
+#
+# startup.jl --
+#
+# Measure the time to first request of XPA.jl, that is the latency of loading
+# the package and of the first requests in a fresh Julia process:
+#
+#     julia --project=benchmark benchmark/startup.jl [NRUNS]
+#
+# runs `NRUNS` (3 by default) fresh processes and prints the median of the
+# times (in seconds) spent by each step.  An XPA name server (`xpans`) must be
+# running or be able to be started.  The server of `server.jl` is used as the
+# peer of the client requests.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+module XPAStartup
+
+using XPA
+
+const SERVER = joinpath(@__DIR__, "server.jl")
+
+# Steps measured in the child process, each one is run once and timed.
+const STEPS = [
+    ("using XPA",               "using XPA"),
+    ("XPA.find",                "XPA.find(\"BENCH:main\"; throwerrors=true)"),
+    ("XPA.get(String)",         "XPA.get(String, \"BENCH:main\", \"null\")"),
+    ("XPA.get(Vector{UInt8})",  "XPA.get(Vector{UInt8}, \"BENCH:main\", \"bytes\", 16)"),
+    ("XPA.get(Array{Float64,2})",
+     "XPA.get(Array{Float64,2}, (2,1), \"BENCH:main\", \"bytes\", 16)"),
+    ("XPA.set(data=Float32[])", "XPA.set(\"BENCH:main\", \"null\"; data=zeros(Float32, 4, 4))"),
+    ("XPA.Server",              "srv = XPA.Server(\"STARTUP\", \"test\", \"\", XPA.SendCallback((_, srv, params, buf) -> (XPA.store!(buf, zeros(Int32, 3)); XPA.SUCCESS)), nothing)"),
+    ("XPA.poll",                "XPA.poll(0, 1)"),
+    ("close(srv)",              "close(srv)"),
+]
+
+# Julia code run by the child process, it prints one line per step with the
+# elapsed time.
+function script()
+    io = IOBuffer()
+    for (name, code) in STEPS
+        println(io, "t0 = time_ns()")
+        println(io, code)
+        println(io, "println(", repr(name), ", '\\t', (time_ns() - t0)/1e9)")
+    end
+    return String(take!(io))
+end
+
+function run_child()
+    cmd = `$(Base.julia_cmd()) --startup-file=no --project=$(@__DIR__) -e $(script())`
+    times = Dict{String,Float64}()
+    for line in eachline(cmd)
+        name, secs = split(line, '\t')
+        times[name] = parse(Float64, secs)
+    end
+    return times
+end
+
+function main(nruns::Integer = 3)
+    proc = run(pipeline(`$(Base.julia_cmd()) --project=$(@__DIR__) $SERVER`;
+                        stdout=devnull, stderr=stderr); wait=false)
+    try
+        t0 = time()
+        while XPA.find("BENCH:main"; cache=false) === nothing
+            process_running(proc) || error("benchmark server failed to start")
+            time() - t0 < 30 || error("timeout for server")
+            sleep(0.1)
+        end
+        runs = [run_child() for i in 1:nruns]
+        total = 0.0
+        println("time to first request (median of $nruns runs):")
+        for (name, _) in STEPS
+            t = sort([run[name] for run in runs])[(nruns + 1) ÷ 2]
+            total += t
+            println(rpad(name, 28), round(t; digits=4), " s")
+        end
+        println(rpad("total", 28), round(total; digits=4), " s")
+    finally
+        try
+            XPA.set("BENCH:main", "quit")
+        catch
+        end
+        wait(proc)
+    end
+end
+
+end # module
+
+if abspath(PROGRAM_FILE) == @__FILE__
+    XPAStartup.main(length(ARGS) ≥ 1 ? parse(Int, ARGS[1]) : 3)
+end
@@ -0,0 +1,188 @@
+#
+# stress.jl --
+#
+# Load test of XPA.jl with many concurrent clients and servers:
+#
+#     julia --project=benchmark -t auto benchmark/stress.jl
+#
+# For each number `N` of servers and `M` of clients, `N` server processes
+# (running `server.jl` as access points `BENCH:s1`, ..., `BENCH:sN`) are
+# started and `M` client tasks, each with its own client connection, send
+# requests to randomly chosen servers for a given duration.  The throughput,
+# the latency percentiles and the error rate are printed for each
+# configuration.  With `XPA_STRESS_MODE=loop`, a single server process
+# with `N` access points is used instead, to measure the contention in its
+# single polling loop.  The number of Julia threads running the client tasks
+# is set by option `-t` or by `JULIA_NUM_THREADS`.  XPA requests block their
+# thread, so client tasks in excess of the number of threads wait for each
+# other.
+#
+# The following environment variables specify the configurations:
+#
+#     XPA_STRESS_SERVERS   numbers of servers (default "1,4")
+#     XPA_STRESS_CLIENTS   numbers of client tasks (default "1,4,16")
+#     XPA_STRESS_SIZES     sizes of the data in bytes (default "0,65536")
+#     XPA_STRESS_SETS      fraction of `XPA.set` requests (default "0.5")
+#     XPA_STRESS_DURATION  duration of each run in seconds (default "3")
+#     XPA_STRESS_MODE      "process" (default) or "loop"
+#
+# The servers are run in the Julia project given by `XPA_BENCH_PROJECT` (this
+# directory by default).
+#
+# An XPA name server (`xpans`) must be running or be able to be started.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+module XPAStress
+
+using XPA, Random
+
+const PROJECT = get(ENV, "XPA_BENCH_PROJECT", @__DIR__)
+const SERVER = joinpath(@__DIR__, "server.jl")
+
+_parse_list(::Type{T}, key::String, def::String) where {T} =
+    [parse(T, str) for str in split(get(ENV, key, def), ',')]
+
+const SERVERS = _parse_list(Int, "XPA_STRESS_SERVERS", "1,4")
+const CLIENTS = _parse_list(Int, "XPA_STRESS_CLIENTS", "1,4,16")
+const SIZES = _parse_list(Int, "XPA_STRESS_SIZES", "0,65536")
+const SETS = parse(Float64, get(ENV, "XPA_STRESS_SETS", "0.5"))
+const DURATION = parse(Float64, get(ENV, "XPA_STRESS_DURATION", "3"))
+const MODE = get(ENV, "XPA_STRESS_MODE", "process")
+
+# Start the servers and yield their processes and access points.
+function start_servers(n::Integer; timeout::Real = 30)
+    procs = Base.Process[]
+    if MODE == "loop"
+        # Access points `BENCH:s1` and `BENCH:apt1`, ... served by a single
+        # polling loop.
+        cmd = `$(Base.julia_cmd()) --project=$PROJECT $SERVER $(n - 1) s1`
+        push!(procs, run(pipeline(cmd; stdout=devnull, stderr=stderr);
+                         wait=false))
+        names = vcat(["s1"], ["apt$i" for i in 1:n-1])
+    elseif MODE == "process"
+        for i in 1:n
+            cmd = `$(Base.julia_cmd()) --project=$PROJECT $SERVER 0 s$i`
+            push!(procs, run(pipeline(cmd; stdout=devnull, stderr=stderr);
+                             wait=false))
+        end
+        names = ["s$i" for i in 1:n]
+    else
+        error("invalid XPA_STRESS_MODE \"$MODE\"")
+    end
+    t0 = time()
+    apts = String[]
+    for name in names
+        while (apt = XPA.find("BENCH:$name"; cache=false)) === nothing
+            all(process_running, procs) || error("benchmark server failed to start")
+            time() - t0 < timeout || (foreach(kill, procs);
+                                      error("timeout for servers"))
+            sleep(0.1)
+        end
+        push!(apts, XPA.address(apt))
+    end
+    return procs, apts
+end
+
+function stop_servers(procs, apts)
+    for i in 1:min(length(procs), length(apts))
+        try
+            XPA.set(apts[i], "quit")
+        catch
+        end
+    end
+    foreach(wait, procs)
+end
+
+# Results of a client task.
+struct Samples
+    latencies::Vector{UInt64} # in nanoseconds
+    errors::Int
+    bytes::Int
+end
+
+# Send requests until `deadline` and collect the latencies.
+function client(apts::Vector{String}, size::Int, sets::Float64,
+                deadline::Float64, seed::Integer)
+    rng = MersenneTwister(seed)
+    data = rand(rng, UInt8, size)
+    conn = XPA.acquire!()
+    latencies = UInt64[]
+    errors = 0
+    bytes = 0
+    try
+        while time() < deadline
+            apt = apts[rand(rng, 1:length(apts))]
+            isset = rand(rng) < sets
+            t0 = time_ns()
+            rep = (isset ? XPA.set(conn, apt, "bytes"; data = data) :
+                   XPA.get(conn, apt, "bytes", size))
+            push!(latencies, time_ns() - t0)
+            if XPA.has_errors(rep) || length(rep) != 1
+                errors += 1
+            else
+                bytes += (isset ? size : Int(rep.lengths[1]))
+            end
+            XPA.release!(rep)
+        end
+    finally
+        XPA.release!(conn)
+    end
+    return Samples(latencies, errors, bytes)
+end
+
+# Run `m` clients for `DURATION` seconds.
+function run_clients(apts::Vector{String}, m::Integer, size::Integer)
+    deadline = time() + DURATION
+    tasks = [Threads.@spawn(client(apts, Int(size), SETS, deadline, k))
+             for k in 1:m]
+    results = map(fetch, tasks)
+    elapsed = time() - deadline + DURATION
+    latencies = sort!(reduce(vcat, [r.latencies for r in results]))
+    errors = sum(r.errors for r in results)
+    bytes = sum(r.bytes for r in results)
+    return (latencies, errors, bytes, elapsed)
+end
+
+percentile(v::AbstractVector, p::Real) =
+    (isempty(v) ? NaN : v[clamp(ceil(Int, p*length(v)), 1, length(v))]/1e6)
+
+function report(io::IO, n, m, size, latencies, errors, bytes, elapsed)
+    count = length(latencies)
+    println(io, lpad(n, 4), lpad(m, 6), lpad(size, 10),
+            lpad(count, 9),
+            lpad(round(count/elapsed; digits=1), 11),
+            lpad(round(bytes/elapsed/2^20; digits=2), 10),
+            lpad(round(percentile(latencies, 0.50); digits=3), 9),
+            lpad(round(percentile(latencies, 0.99); digits=3), 9),
+            lpad(round(percentile(latencies, 0.999); digits=3), 9),
+            lpad(round(100*errors/max(count, 1); digits=2), 8))
+end
+
+function main(io::IO = stdout)
+    println(io, "mode = ", MODE, ", duration = ", DURATION, " s, ",
+            "set fraction = ", SETS, ", threads = ", Threads.nthreads())
+    println(io, lpad("N", 4), lpad("M", 6), lpad("bytes", 10),
+            lpad("requests", 9), lpad("req/s", 11), lpad("MiB/s", 10),
+            lpad("p50 ms", 9), lpad("p99 ms", 9), lpad("p999 ms", 9),
+            lpad("errors%", 8))
+    for n in SERVERS
+        procs, apts = start_servers(n)
+        try
+            for m in CLIENTS, size in SIZES
+                report(io, n, m, size, run_clients(apts, m, size)...)
+            end
+        finally
+            stop_servers(procs, apts)
+        end
+    end
+end
+
+end # module
+
+if abspath(PROGRAM_FILE) == @__FILE__
+    XPAStress.main()
+end
@@ -12,13 +12,27 @@
 module XPA
 
 using XPA_jll
+using FileWatching
+using Mmap
 
 using Base: ENV, @propagate_inbounds
 
 include("cdefs.jl")
 include("types.jl")
 include("misc.jl")
+include("compression.jl")
+include("instrument.jl")
 include("client.jl")
+include("health.jl")
+include("async.jl")
 include("server.jl")
+include("respcache.jl")
+include("commands.jl")
+include("publish.jl")
+include("framing.jl")
+include("decode.jl")
+include("sharedmem.jl")
+include("workqueue.jl")
+include("precompile.jl")
 
 end # module
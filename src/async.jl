@@ -0,0 +1,136 @@
+#
+# async.jl --
+#
+# Implement asynchronous XPA client requests.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+"""
+    XPA.get_async(apt, args...; pool=XPA.connection_pool(), kwds...) -> req
+
+starts an asynchronous [`XPA.get`](@ref) request to the XPA access point(s)
+`apt` with arguments `args...` and returns immediately.  The result `req` is
+an instance of [`XPA.Request`](@ref) which can be waited for by `wait(req)`,
+whose answer can be retrieved by `fetch(req)` (which waits for completion if
+needed) and which can be cancelled by [`XPA.cancel!`](@ref).  Call
+`isready(req)` to check whether the request has completed.
+
+The blocking XPA call is run in the thread pool of libuv (see `@threadcall`),
+so the calling task yields and other Julia tasks, on the same thread, can run
+in the meantime.  The XPA library is not thread-safe, so its calls are
+serialized: requests started concurrently are sent one after the other while
+their tasks, and the servers of the process, keep running.  Each request
+uses its own client connection taken from the pool specified by keyword
+`pool` (see [`XPA.ConnectionPool`](@ref)).
+
+Keywords `mode`, `nmax`, `throwerrors`, `users`, `timeout` and `deadline`
+are the same as for [`XPA.get`](@ref).  The time limit set by `timeout` starts
+when `XPA.get_async` is called.
+
+See also [`XPA.set_async`](@ref) and [`XPA.getmany`](@ref).
+
+"""
+function get_async(apt::Union{AbstractString,AccessPoint}, args...;
+                   pool::ConnectionPool = _POOL,
+                   mode::AbstractString = "",
+                   nmax::Integer = 1,
+                   throwerrors::Bool = false,
+                   users::Union{Nothing,AbstractString} = nothing,
+                   timeout::Real = Inf,
+                   deadline::Real = Inf)
+    addr = (apt isa AccessPoint ? address(apt) : String(apt))
+    deadline = _deadline(timeout, deadline)
+    return _async(pool) do conn
+        _get(conn, addr, join_arguments(args), mode, _nmax(nmax),
+             throwerrors, users, true, deadline)
+    end
+end
+
+"""
+    XPA.set_async(apt, args...; data=nothing, pool=XPA.connection_pool(), kwds...) -> req
+
+starts an asynchronous [`XPA.set`](@ref) request to the XPA access point(s)
+`apt` with arguments `args...` and returns immediately.  The result `req` is
+an instance of [`XPA.Request`](@ref), see [`XPA.get_async`](@ref) for
+details.  Keywords `data`, `mode`, `nmax`, `throwerrors`, `users`, `timeout`,
+`deadline` and `retry` are the same as for [`XPA.set`](@ref).  Argument `data` must not be modified before the
+request completes.
+
+"""
+function set_async(apt::Union{AbstractString,AccessPoint}, args...;
+                   pool::ConnectionPool = _POOL,
+                   data = nothing,
+                   mode::AbstractString = "",
+                   nmax::Integer = 1,
+                   throwerrors::Bool = false,
+                   users::Union{Nothing,AbstractString} = nothing,
+                   timeout::Real = Inf,
+                   deadline::Real = Inf,
+                   retry::Bool = false)
+    addr = (apt isa AccessPoint ? address(apt) : String(apt))
+    deadline = _deadline(timeout, deadline)
+    buf = buffer(data)
+    return _async(pool) do conn
+        _set(conn, addr, join_arguments(args), mode, buf, _nmax(nmax),
+             throwerrors, users, true, deadline, retry)
+    end
+end
+
+# Run `func(conn)` in a task with a connection taken from `pool`.  If the
+# request has been cancelled when it completes, its answer is released.
+function _async(func::Function, pool::ConnectionPool)
+    cancelled = Threads.Atomic{Bool}(false)
+    task = @async begin
+        rep = _with_connection(func, pool)::Reply
+        if cancelled[]
+            release!(rep)
+            nothing
+        else
+            rep
+        end
+    end
+    return Request(task, cancelled)
+end
+
+"""
+    XPA.cancel!(req)
+
+cancels the asynchronous request `req`.  XPA requests cannot be interrupted,
+so the request still runs to completion (its connection is not available in
+the meantime) but its answer is discarded and a subsequent `fetch(req)` throws
+an exception.
+
+See also [`XPA.get_async`](@ref) and [`XPA.set_async`](@ref).
+
+"""
+function cancel!(req::Request)
+    req.cancelled[] = true
+    return nothing
+end
+
+iscancelled(req::Request) = req.cancelled[]
+
+Base.isready(req::Request) = istaskdone(req.task)
+
+Base.wait(req::Request) = (wait(req.task); nothing)
+
+function Base.fetch(req::Request)::Reply
+    iscancelled(req) && throw_request_cancelled()
+    rep = fetch(req.task)
+    if rep === nothing || iscancelled(req)
+        rep === nothing || release!(rep)
+        throw_request_cancelled()
+    end
+    return rep
+end
+
+@noinline throw_request_cancelled() = error("XPA request has been cancelled")
+
+function Base.show(io::IO, req::Request)
+    print(io, "XPA.Request(", (iscancelled(req) ? "cancelled" :
+                               isready(req) ? "done" : "running"), ")")
+end
@@ -23,7 +23,7 @@ exchanges with a given access point.
 !!! note
     To avoid the delay for connecting to the XPA server, all XPA methods that
     perform XPA client requests now automatically use a connection that is kept
-    open for the calling thread.  Directly calling `XPA.Client()` should be
+    open for the calling task.  Directly calling `XPA.Client()` should be
     unnecessary, this method is kept for backward compatibility.
 
 See also [`XPA.set`](@ref), [`XPA.get`](@ref), [`XPA.list`](@ref) and
@@ -36,81 +36,316 @@ Client() = Client(_open())
     XPA.connection()
 
 yields a persistent XPA client connection that is kept open for the calling
-thread (a different connection is memorized for each Julia thread).
+task (a different connection is memorized, in the task local storage, for
+each Julia task).  Since a task runs on a single thread at a time and is the
+only user of its connection, the connection can be kept by the task across
+yield points.
 
-Per-thread client connections are automatically open (or even re-open) as
-needed.
+Per-task client connections are automatically open (or even re-open) as
+needed and closed when their task is garbage collected.
 
-""" connection
+!!! note
+    Each task sending requests opens its own connection.  Many short-lived
+    tasks should rather take their connection from a
+    [`XPA.ConnectionPool`](@ref) to reuse them.
 
-const CONNECTIONS = Client[]
+""" connection
 
 function connection()
-    id = Threads.threadid()
-    while length(CONNECTIONS) < id
-        push!(CONNECTIONS, Client(C_NULL))
+    tls = task_local_storage()
+    conn = Base.get(tls, :XPA_CONNECTION, nothing)
+    if conn === nothing
+        conn = Client(_open())
+        tls[:XPA_CONNECTION] = conn
+    elseif !isopen(conn)
+        # Automatically re-open the client connection.
+        conn.ptr = _open()
     end
-    if !isopen(CONNECTIONS[id])
-        # Automatically (re)open the client connection.
-        CONNECTIONS[id].ptr = _open()
+    return conn::Client
+end
+
+"""
+    XPA.connection_pool()
+
+yields the pool of client connections used by [`XPA.getmany`](@ref) and
+[`XPA.setmany`](@ref).
+
+""" connection_pool
+
+const _POOL = ConnectionPool()
+
+connection_pool() = _POOL
+
+"""
+    XPA.acquire!(pool=XPA.connection_pool()) -> conn
+
+takes a persistent client connection from `pool`, a new connection is open if
+there are no idle connections in the pool.  The caller has exclusive use of
+`conn` until it is given back by `XPA.release!(pool, conn)`.
+
+"""
+function acquire!(pool::ConnectionPool = _POOL)
+    conn = nothing
+    lock(pool.lock)
+    try
+        isempty(pool.free) || (conn = pop!(pool.free))
+    finally
+        unlock(pool.lock)
     end
-    return CONNECTIONS[id]
+    return (conn === nothing ? Client() : conn)
+end
+
+"""
+    XPA.release!(pool=XPA.connection_pool(), conn)
+
+gives back client connection `conn` to `pool`.  The connection is closed if
+there are already `pool.maxsize` idle connections in the pool.
+
+"""
+release!(conn::Client) = release!(_POOL, conn)
+
+function release!(pool::ConnectionPool, conn::Client)
+    keep = false
+    if isopen(conn)
+        lock(pool.lock)
+        try
+            if length(pool.free) < pool.maxsize
+                push!(pool.free, conn)
+                keep = true
+            end
+        finally
+            unlock(pool.lock)
+        end
+    end
+    keep || close(conn)
+    return nothing
+end
+
+function Base.show(io::IO, pool::ConnectionPool)
+    print(io, "XPA.ConnectionPool(", length(pool.free), " idle connection",
+          (length(pool.free) > 1 ? "s" : ""), ", maxsize = ", pool.maxsize,
+          ")")
 end
 
+# Call `func(conn, args...; kwds...)` with a connection taken from `pool`.
+function _with_connection(func, pool::ConnectionPool, args...; kwds...)
+    conn = acquire!(pool)
+    try
+        return func(conn, args...; kwds...)
+    finally
+        release!(pool, conn)
+    end
+end
+
+# The XPA library is not thread-safe (see `_XPA_LOCK`): its client routines
+# use global lists of connections and of servers.  All calls to them are
+# serialized by `_CLIENT_LOCK`.  This is a task lock, so a task waiting for a
+# request run by `@threadcall` lets the other tasks run (they only wait if
+# they send a request), and it is distinct from `_XPA_LOCK` so that the
+# servers of this process can answer the requests of its clients.
+const _CLIENT_LOCK = ReentrantLock()
+
 function _open()
     # The argument of XPAOpen is currently ignored (it is reserved for future
     # use).
-    ptr = ccall((:XPAOpen, libxpa), Ptr{Cvoid}, (Ptr{Cvoid},), C_NULL)
+    local ptr::Ptr{Cvoid}
+    lock(_CLIENT_LOCK)
+    try
+        ptr = ccall((:XPAOpen, libxpa), Ptr{Cvoid}, (Ptr{Cvoid},), C_NULL)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
     ptr != C_NULL || error("failed to create a persistent XPA connection")
     return ptr
 end
 
+# The following method is called upon garbage collection of a client
+# connection.  As for servers, closing is deferred to the next garbage
+# collection if the lock is held by another task.
+function _finalize(conn::Client)
+    if trylock(_CLIENT_LOCK)
+        try
+            close(conn)
+        finally
+            unlock(_CLIENT_LOCK)
+        end
+    else
+        finalizer(_finalize, conn)
+    end
+    return nothing
+end
+
 function Base.close(conn::Client)
     if (ptr = conn.ptr) != C_NULL
         conn.ptr = C_NULL # avoid closing more than once!
-        ccall((:XPAClose, libxpa), Cvoid, (Ptr{Cvoid},), ptr)
+        lock(_CLIENT_LOCK)
+        try
+            ccall((:XPAClose, libxpa), Cvoid, (Ptr{Cvoid},), ptr)
+        finally
+            unlock(_CLIENT_LOCK)
+        end
     end
     return nothing
 end
 
 """
-    XPA.list(conn=XPA.connection())
+    XPA.list(conn=XPA.connection(); timeout=Inf, deadline=Inf)
 
 yields a list of available XPA access points.  The result is a vector of
 [`XPA.AccessPoint`](@ref) instances.  Optional argument `conn` is a persistent
 XPA client connection (created by [`XPA.Client`](@ref)); if omitted, a
-per-thread connection is used (see [`XPA.connection`](@ref)).
+per-task connection is used (see [`XPA.connection`](@ref)).  Keywords
+`timeout` and `deadline` limit the duration of the query to the name server
+as for [`XPA.get`](@ref), an exception is thrown if no answer is received in
+time.
 
 See also [`XPA.Client`](@ref), [`XPA.connection`](@ref) and [`XPA.find`](@ref).
 
 """
-function list(conn::Client = connection())
+function list(conn::Client = connection();
+              timeout::Real = Inf,
+              deadline::Real = Inf)
+    return _get1(conn, "xpans";
+                 deadline = _deadline(timeout, deadline)) do rep
+        _parse_listing(_get_buf(rep, 1, true)...)
+    end
+end
+
+# Parse the answer of the name server which has one line per access point
+# with fields `class name access addr user` separated by spaces.  The bytes
+# are scanned in place and the strings of the fields are interned.
+function _parse_listing(ptr::Ptr{Byte}, len::Int)
     lst = AccessPoint[]
-    for str in split(chomp(get(String, conn, "xpans")), r"\n|\r\n?";
-                     keepempty=false)
-        arr = split(str; keepempty=false)
-        if length(arr) != 5
-            @warn "expecting 5 fields per access point (\"$str\")"
-            continue
-        end
-        access = zero(GET)
-        for c in arr[3]
-            if c == 'g'
-                access |= GET
-            elseif c == 's'
-                access |= SET
-            elseif c == 'i'
-                access |= INFO
-            else
-                @warn "unexpected access string (\"$(arr[3])\")"
-                continue
-            end
+    bounds = Vector{Int}(undef, 12) # first and last indices of 6 fields
+    i = 1
+    while i ≤ len
+        j = i
+        while j ≤ len && (c = unsafe_load(ptr, j)) != UInt8('\n') &&
+                c != UInt8('\r')
+            j += 1
         end
-        push!(lst, AccessPoint(arr[1], arr[2], arr[4], arr[5], access))
+        j > i && _parse_access_point!(lst, bounds, ptr, i, j - 1)
+        i = j + 1
     end
     return lst
 end
 
+function _parse_access_point!(lst::Vector{AccessPoint}, bounds::Vector{Int},
+                              ptr::Ptr{Byte}, first::Int, last::Int)
+    nfields = 0
+    k = first
+    while nfields < 6
+        while k ≤ last && _isspace(unsafe_load(ptr, k))
+            k += 1
+        end
+        k ≤ last || break
+        nfields += 1
+        bounds[2*nfields - 1] = k
+        while k ≤ last && !_isspace(unsafe_load(ptr, k))
+            k += 1
+        end
+        bounds[2*nfields] = k - 1
+    end
+    if nfields != 5
+        nfields == 0 && return nothing
+        @warn "expecting 5 fields per access point (\"$(unsafe_string(ptr + (first - 1), last - first + 1))\")"
+        return nothing
+    end
+    access = zero(GET)
+    for k in bounds[5]:bounds[6]
+        c = unsafe_load(ptr, k)
+        if c == UInt8('g')
+            access |= GET
+        elseif c == UInt8('s')
+            access |= SET
+        elseif c == UInt8('i')
+            access |= INFO
+        else
+            @warn "unexpected access string (\"$(unsafe_string(ptr + (bounds[5] - 1), bounds[6] - bounds[5] + 1))\")"
+            return nothing
+        end
+    end
+    push!(lst, AccessPoint(_field(ptr, bounds, 1), _field(ptr, bounds, 2),
+                           _field(ptr, bounds, 4), _field(ptr, bounds, 5),
+                           access))
+    return nothing
+end
+
+_field(ptr::Ptr{Byte}, bounds::Vector{Int}, n::Int) =
+    _intern(ptr + (bounds[2n-1] - 1), bounds[2n] - bounds[2n-1] + 1)
+
+# The strings of the answers of the name server are interned so that
+# refreshing the list of access points does not allocate the same strings
+# again.  The table is emptied if it grows too large.
+const _INTERNED = Dict{UInt64,String}()
+const _INTERNED_LOCK = Threads.SpinLock()
+const _INTERNED_MAX = 10_000
+
+function _intern(ptr::Ptr{Byte}, len::Int)
+    h = _fnv1a(ptr, len)
+    lock(_INTERNED_LOCK)
+    try
+        str = Base.get(_INTERNED, h, nothing)
+        if str !== nothing && sizeof(str) == len &&
+            GC.@preserve(str, ccall(:memcmp, Cint,
+                                    (Ptr{Byte}, Ptr{Byte}, Csize_t),
+                                    pointer(str), ptr, len)) == 0
+            return str
+        end
+        length(_INTERNED) < _INTERNED_MAX || empty!(_INTERNED)
+        str = unsafe_string(ptr, len)
+        _INTERNED[h] = str
+        return str
+    finally
+        unlock(_INTERNED_LOCK)
+    end
+end
+
+function NameIndex(lst::AbstractVector{AccessPoint})
+    idx = NameIndex()
+    resize!(idx.next, length(lst))
+    # Proceed backward so that the first access point of a chain is the first
+    # one in the list.
+    for j in length(lst):-1:1
+        key = (lst[j].class, lst[j].name)
+        idx.next[j] = (Base.get(idx.pairs, key, 0),
+                       Base.get(idx.names, lst[j].name, 0))
+        idx.pairs[key] = j
+        idx.names[lst[j].name] = j
+    end
+    return idx
+end
+
+# Yield the first access point of `lst` matching `class`, `name` (both may be
+# `"*"`) and `user` or `nothing`.  If `idx` is the index of `lst`, the
+# candidates are directly found for a given name.
+function _first_match(lst::AbstractVector{AccessPoint},
+                      idx::Union{NameIndex,Nothing},
+                      class::AbstractString, name::AbstractString,
+                      user::AbstractString)
+    anyuser = (user == "*")
+    if idx === nothing || name == "*"
+        anyclass = (class == "*")
+        anyname = (name == "*")
+        for apt in lst
+            if ((anyuser || apt.user == user) &&
+                (anyclass || apt.class == class) &&
+                (anyname || apt.name == name))
+                return apt
+            end
+        end
+    else
+        anyclass = (class == "*")
+        j = (anyclass ? Base.get(idx.names, name, 0) :
+             Base.get(idx.pairs, (class, name), 0))
+        while j > 0
+            (anyuser || lst[j].user == user) && return lst[j]
+            j = idx.next[j][anyclass ? 2 : 1]
+        end
+    end
+    return nothing
+end
+
 """
     XPA.find([conn=XPA.connection(),] ident) -> apt
 
@@ -131,7 +366,7 @@ form `CLASS:NAME` where `CLASS` and `CLASS` are matched against the server
 class and name respectively (they may be `"*"` to match any).
 
 Optional argument `conn` is a persistent XPA client connection (created by
-[`XPA.Client`](@ref)); if omitted, a per-thread connection is used (see
+[`XPA.Client`](@ref)); if omitted, a per-task connection is used (see
 [`XPA.connection`](@ref)).
 
 Keyword `user` may be used to specify the user name of the owner of the server
@@ -141,7 +376,15 @@ is `user="*"` which matches any user.
 Keyword `throwerrors` may be set true (it is false by default) to automatically
 throw an exception if no match is found (instead of returning `nothing`).
 
-See also [`XPA.Client`](@ref), [`XPA.address`](@ref) and [`XPA.list`](@ref).
+If `ident` is a string, keyword `cache` (true by default) specifies whether to
+use the cache of access points (see [`XPA.namecache`](@ref)) to avoid querying
+the XPA name server.
+
+Keywords `timeout` and `deadline` limit the duration of the query to the name
+server, see [`XPA.list`](@ref).
+
+See also [`XPA.Client`](@ref), [`XPA.address`](@ref), [`XPA.list`](@ref) and
+[`XPA.invalidate!`](@ref).
 
 """
 find(ident::Union{AbstractString,Regex}; kwds...) =
@@ -150,37 +393,59 @@ find(ident::Union{AbstractString,Regex}; kwds...) =
 function find(conn::Client,
               ident::AbstractString;
               user::AbstractString = "*",
-              throwerrors::Bool = false)::Union{AccessPoint,Nothing}
-    i = findfirst(isequal(':'), ident)
-    if i === nothing
-        # allow any class
-        class = "*"
-        name = ident
-    else
-        class = ident[1:i-1]
-        name = ident[i+1:end]
+              throwerrors::Bool = false,
+              cache::Bool = true,
+              timeout::Real = Inf,
+              deadline::Real = Inf)::Union{AccessPoint,Nothing}
+    class, name = _split_ident(ident)
+    key = (class, name, String(user))
+    if cache
+        apt = _lookup(_NAMECACHE, key)
+        apt === nothing || return apt
     end
-    anyuser = (user == "*")
-    anyclass = (class == "*")
-    anyname = (name == "*")
-    lst = list(conn)
-    for j in eachindex(lst)
-        if ((anyuser || lst[j].user == user) &&
-            (anyclass || lst[j].class == class) &&
-            (anyname || lst[j].name == name))
-            return lst[j]
+    if cache
+        # Search the list of access points if it is still valid.
+        apt = _find_listed(_NAMECACHE, class, name, key[3])
+        if apt !== nothing
+            _remember!(_NAMECACHE, key, apt)
+            return apt
         end
     end
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    lst = list(conn; deadline = _deadline(timeout, deadline))
+    _instrumented() && _record_lookup!(ident, time_ns() - t0)
+    if cache
+        idx = NameIndex(lst)
+        _store_listing!(_NAMECACHE, lst, idx)
+        apt = _first_match(lst, idx, class, name, key[3])
+        apt === nothing || (_remember!(_NAMECACHE, key, apt); return apt)
+    else
+        apt = _first_match(lst, nothing, class, name, key[3])
+        apt === nothing || return apt
+    end
     throwerrors && throw_no_servers_match(ident)
     return nothing
 end
 
+# Split `CLASS:NAME` identifier, the class is `"*"` if not specified.
+function _split_ident(ident::AbstractString)
+    i = findfirst(isequal(':'), ident)
+    if i === nothing
+        # allow any class
+        return ("*", String(ident))
+    else
+        return (String(ident[1:i-1]), String(ident[i+1:end]))
+    end
+end
+
 function find(conn::Client,
               ident::Regex;
               user::AbstractString = "*",
-              throwerrors::Bool = false)::Union{AccessPoint,Nothing}
+              throwerrors::Bool = false,
+              timeout::Real = Inf,
+              deadline::Real = Inf)::Union{AccessPoint,Nothing}
     anyuser = (user == "*")
-    lst = list(conn)
+    lst = list(conn; deadline = _deadline(timeout, deadline))
     for j in eachindex(lst)
         if ((anyuser || lst[j].user == user) &&
             occursin(ident, lst[j].class*":"*lst[j].name))
@@ -191,6 +456,183 @@ function find(conn::Client,
     return nothing
 end
 
+"""
+    XPA.namecache() -> cache
+
+yields the cache of access points used by [`XPA.find`](@ref) and
+[`XPA.address`](@ref).  The result is an instance of [`XPA.NameCache`](@ref)
+whose time to live (in seconds) can be changed by setting `cache.ttl` and
+whose fields `cache.hits` and `cache.misses` are the number of successful and
+failed look-ups.
+
+Entries of the cache are automatically invalidated when they expire or when a
+request to their address fails to reach the server (errors answered by the
+server do not invalidate the cache).  See [`XPA.invalidate!`](@ref) to
+explicitly invalidate entries.
+
+The cache is used when an access point is resolved by [`XPA.find`](@ref) or
+[`XPA.address`](@ref) (hence by [`XPA.bind`](@ref) and the `users` keyword
+of the requests).  A request whose access point is a template like
+`"DS9:*"` is resolved by the XPA library which queries the name server for
+each request: call `XPA.address("DS9:*")` to resolve the template once and
+send the requests to the address (to the first matching server only).
+
+"""
+namecache() = _NAMECACHE
+
+const _NAMECACHE = NameCache()
+
+"""
+    XPA.invalidate!(cache=XPA.namecache())
+
+invalidates all entries in the cache of access points while:
+
+    XPA.invalidate!([cache=XPA.namecache(),] ident; user="*")
+
+only invalidates the entry matching the access point identifier `ident` (a
+string of the form `CLASS:NAME`) and the owner `user`, and:
+
+    XPA.invalidate!([cache=XPA.namecache(),] apt::XPA.AccessPoint)
+
+invalidates all entries whose address is that of `apt`.
+
+See also [`XPA.namecache`](@ref) and [`XPA.find`](@ref).
+
+"""
+invalidate!() = invalidate!(_NAMECACHE)
+invalidate!(ident::AbstractString; kwds...) =
+    invalidate!(_NAMECACHE, ident; kwds...)
+invalidate!(apt::AccessPoint) = invalidate!(_NAMECACHE, apt)
+
+function invalidate!(cache::NameCache)
+    lock(cache.lock) do
+        empty!(cache.entries)
+        cache.listing = AccessPoint[]
+        cache.index = NameIndex()
+        cache.expires = 0.0
+    end
+    return cache
+end
+
+function invalidate!(cache::NameCache, ident::AbstractString;
+                     user::AbstractString = "*")
+    key = (_split_ident(ident)..., String(user))
+    lock(cache.lock) do
+        delete!(cache.entries, key)
+    end
+    return cache
+end
+
+invalidate!(cache::NameCache, apt::AccessPoint) =
+    _forget_address(cache, apt.addr)
+
+function _lookup(cache::NameCache, key::NTuple{3,String})
+    lock(cache.lock)
+    try
+        if cache.ttl > 0
+            entry = Base.get(cache.entries, key, nothing)
+            if entry !== nothing
+                if entry[2] > time()
+                    cache.hits += 1
+                    return entry[1]
+                end
+                delete!(cache.entries, key)
+            end
+        end
+        cache.misses += 1
+        return nothing
+    finally
+        unlock(cache.lock)
+    end
+end
+
+function _remember!(cache::NameCache, key::NTuple{3,String}, apt::AccessPoint)
+    lock(cache.lock)
+    try
+        if cache.ttl > 0
+            cache.entries[key] = (apt, time() + cache.ttl)
+        end
+    finally
+        unlock(cache.lock)
+    end
+    return nothing
+end
+
+# Invalidate all entries whose address is `addr`.
+function _forget_address(cache::NameCache, addr::AbstractString)
+    lock(cache.lock)
+    try
+        filter!(entry -> entry.second[1].addr != addr, cache.entries)
+        if any(apt -> apt.addr == addr, cache.listing)
+            cache.listing = filter(apt -> apt.addr != addr, cache.listing)
+            cache.index = NameIndex(cache.listing)
+        end
+    finally
+        unlock(cache.lock)
+    end
+    return cache
+end
+
+# Invalidate cached entries for the address of a request which failed to
+# reach the server (see `_failed`), errors answered by the server do not
+# invalidate the cache.
+function _check_address(apt::AbstractString, rep::Reply)
+    _failed(rep, length(rep)) && _forget_address(_NAMECACHE, apt)
+    return nothing
+end
+
+# Yield the list of access points known by the name server, the list is
+# cached for `cache.ttl` seconds.  The result must not be modified.
+function _listing(conn::Client, cache::NameCache = _NAMECACHE)
+    lock(cache.lock)
+    try
+        if cache.ttl > 0 && cache.expires > time()
+            cache.hits += 1
+            return cache.listing
+        end
+        cache.misses += 1
+    finally
+        unlock(cache.lock)
+    end
+    lst = list(conn)
+    _store_listing!(cache, lst, NameIndex(lst))
+    return lst
+end
+
+function _store_listing!(cache::NameCache, lst::Vector{AccessPoint},
+                         idx::NameIndex)
+    lock(cache.lock)
+    try
+        if cache.ttl > 0
+            cache.listing = lst
+            cache.index = idx
+            cache.expires = time() + cache.ttl
+        end
+    finally
+        unlock(cache.lock)
+    end
+    return nothing
+end
+
+# Yield the first access point matching `class`, `name` and `user` in the
+# list of access points memorized by `cache` if it has not expired.
+function _find_listed(cache::NameCache, class::AbstractString,
+                      name::AbstractString, user::AbstractString)
+    lock(cache.lock)
+    try
+        (cache.ttl > 0 && cache.expires > time()) || return nothing
+        return _first_match(cache.listing, cache.index, class, name, user)
+    finally
+        unlock(cache.lock)
+    end
+end
+
+function Base.show(io::IO, cache::NameCache)
+    print(io, "XPA.NameCache(", length(cache.entries), " entries, ttl = ",
+          cache.ttl, " s, hits = ", cache.hits, ", misses = ", cache.misses,
+          ")")
+end
+
 @noinline throw_no_servers_match(ident::AbstractString) =
     error("no XPA servers match pattern \"$(ident)\"")
 
@@ -203,20 +645,23 @@ end
 yields the address of XPA accesspoint `apt` which can be: an instance of
 `XPA.AccessPoint`, a string with a valid XPA server address or a server
 `class:name` identifier.  In the latter case, [`XPA.find`](@ref) is called to
-find a matching server which is much longer.
+find a matching server which is much longer unless the server address has been
+memorized in the cache of access points (see [`XPA.namecache`](@ref)).
 
 """
 address(apt::XPA.AccessPoint) =
     apt.addr
 
-function address(apt::AbstractString)
+address(apt::AbstractString) =
+    (_is_address(apt) ? apt : address(XPA.find(apt; throwerrors = true)))
+
+# Yield whether `apt` is the address `host:port` of a server (with `host` in
+# hexadecimal).
+function _is_address(apt::AbstractString)
     i = findfirst(isequal(':'), apt)
-    if (i === nothing ||
-        tryparse(UInt, apt[1:i-1],  base = 16) === nothing ||
-        tryparse(UInt, apt[i+1:end],  base = 10) === nothing)
-        return address(XPA.find(apt; throwerrors = true))
-    end
-    return apt
+    return (i !== nothing &&
+            tryparse(UInt, apt[1:i-1],  base = 16) !== nothing &&
+            tryparse(UInt, apt[i+1:end],  base = 10) !== nothing)
 end
 
 """
@@ -227,7 +672,7 @@ template name, a `host:port` string or the name of a Unix socket file) with
 arguments `args...` (automatically converted into a single string where the
 arguments are separated by a single space).  Optional argument `conn` is a
 persistent XPA client connection (created by [`XPA.Client`](@ref)); if omitted,
-a per-thread connection is used (see [`XPA.connection`](@ref)).  The returned
+a per-task connection is used (see [`XPA.connection`](@ref)).  The returned
 value depends on the optional arguments `T` and `dims`.
 
 If neither `T` nor `dims` are specified, an instance of [`XPA.Reply`](@ref) is
@@ -244,12 +689,59 @@ are available:
 * Keyword `mode` specifies options in the form `"key1=value1,key2=value2"`.
 
 * Keyword `users` specifies the list of possible users owning the access-point.
-  This (temporarily) overrides the settings in environment variable
-  `XPA_NSUSERS`.  By default and if the environment variable `XPA_NSUSERS` is
-  not set, the access-point must be owned the caller (see Section
-  *Distinguishing Users* in XPA documentation).  The value is a string wich may
-  be a list of comma separated user names or `"*"` to access all users on a
-  given machine.
+  This overrides the settings in environment variable `XPA_NSUSERS` for this
+  request.  By default and if the environment variable `XPA_NSUSERS` is not
+  set, the access-point must be owned the caller (see Section *Distinguishing
+  Users* in XPA documentation).  The value is a string wich may be a list of
+  comma separated user names or `"*"` to access all users on a given machine.
+  The matching access points are found from the list of access points known by
+  the name server (cached as explained in [`XPA.namecache`](@ref)) and the
+  request is sent to each of them, so concurrent requests with different users
+  do not interfere.
+
+* Keyword `compress` specifies whether to ask the server(s) to compress the
+  data of their answers, `compress=false` by default.  Compression (by the
+  LZ4 algorithm, by chunks processed in parallel when Julia has several
+  threads) is worth for large data transferred between different hosts.  The
+  data are decompressed in the buffers of the answers, so the result is the
+  same as without compression.  The server must have been implemented with
+  the Julia XPA package, other servers would get an invalid parameter list.
+
+* Keyword `shm` specifies whether to ask the server(s) to transfer large data
+  through shared memory rather than through the socket, `shm=false` by
+  default.  This is only possible for a server implemented with the Julia XPA
+  package and running on the same host as the client (with the same user).
+  The server writes its answer in a file of `/dev/shm` (or of
+  `XPA.getconfig("XPA_TMPDIR")` if `/dev/shm` does not exist) and only sends
+  the name of the file.  The client maps the file in memory and deletes it,
+  the data buffer of the answer is then the mapped memory.  Files which are
+  not mapped are deleted when the answer is released (see also
+  [`XPA.cleanup_shared`](@ref)).  With
+  `XPA.get_data(Vector{T}, rep, i)` or `XPA.get_data(Array{T,N}, dims, rep,
+  i)` (that is when the data buffer is not preserved), the result is a
+  zero-copy array which keeps the mapping alive.  Small data are sent through
+  the socket.
+
+* Keywords `timeout` and `deadline` limit the duration of the request:
+  `timeout` is the maximum number of seconds to wait for the answer(s) and
+  `deadline` is the time (as given by `time()`) at which the request must be
+  complete, both are `Inf` by default.  The limit applies to the whole
+  request (including the resolution of `users` and the answers of all the
+  servers).  This does not modify the timeouts of the XPA library (see
+  [`XPA.getconfig`](@ref)) which remain in force and are global to the
+  process: the request is run by a task, with a connection taken from the
+  pool (see [`XPA.connection_pool`](@ref)), which is abandoned if it is not
+  complete in time.  The answer is then a single error message.  An
+  abandoned request keeps its connection, a thread of libuv pool (see
+  `@threadcall`) and the lock serializing the calls to the XPA library (other
+  requests wait meanwhile) until the XPA library returns, which may take up to
+  `XPA_LONG_TIMEOUT` seconds for a server which does not answer.  To not
+  exhaust the pool (4 threads unless `UV_THREADPOOL_SIZE` is set before
+  starting Julia), requests with a time limit fail immediately, with an
+  error message, while `XPA.getconfig("XPA_MAXABANDONED")` abandoned requests
+  (half the size of the pool by default) are still running.  Since
+  `deadline` is an absolute time, it can be given unchanged to all the
+  requests of a sequence which must be complete within a given budget.
 
 If `T` and, possibly, `dims` are specified, a single answer and no errors are
 expected (as if `nmax=1` and `throwerrors=true`) and the data part of the
@@ -259,6 +751,10 @@ an optional list of dimensions:
 * If only `T` is specified, it can be `String` to return a string interpreting
   the data as ASCII characters or a type like `Vector{S}` to return the largest
   vector of elements of type `S` that can be extracted from the returned data.
+  With keyword `text=true`, `Vector{S}` yields the numbers written in textual
+  form in the data.  Numeric types `T` like `Float64` or `NTuple{N,S}` yield a
+  single number or a tuple of `N` numbers written in textual form.  Numbers
+  are parsed directly in the data buffer, without building a `String`.
 
 * If both `T` and `dims` are specified, `T` can be a type like `Array{S}` or
   `Array{S,N}` and `dims` a list of `N` dimensions to retrieve the data as an
@@ -274,8 +770,42 @@ function get(conn::Client,
              mode::AbstractString = "",
              nmax::Integer = 1,
              throwerrors::Bool = false,
-             users::Union{Nothing,AbstractString} = nothing)
-    return _get(conn, apt, cmd, mode, _nmax(nmax), throwerrors, users)
+             users::Union{Nothing,AbstractString} = nothing,
+             compress::Bool = false,
+             shm::Bool = false,
+             timeout::Real = Inf,
+             deadline::Real = Inf)
+    opts = ((compress ? _OPTION_LZ4 : UInt(0)) |
+            (shm ? _OPTION_SHM : UInt(0)))
+    opts == 0 && return _get(conn, apt, cmd, mode, _nmax(nmax), throwerrors,
+                             users, false, _deadline(timeout, deadline))
+    # Errors are checked after having mapped the shared memory files, which
+    # are otherwise deleted when `rep` is released.
+    rep = _get(conn, apt, _options_prefix(opts)*cmd, mode, _nmax(nmax),
+               false, users, false, _deadline(timeout, deadline))
+    rep.shared = shm
+    compress && _decompress!(rep)
+    shm && _map_shared!(rep)
+    throwerrors && _verify_or_release(rep)
+    return rep
+end
+
+# Replace the compressed data buffers of a reply by their decompressed
+# version.
+function _decompress!(rep::Reply)
+    for i in 1:length(rep)
+        ptr, len = rep.buffers[i], rep.lengths[i]
+        if _is_compressed(ptr, len)
+            try
+                rep.buffers[i], rep.lengths[i] = _decompress(ptr, len)
+            catch
+                release!(rep)
+                rethrow()
+            end
+            _free(ptr)
+        end
+    end
+    return rep
 end
 
 get(apt::AccessPoint, args...; kwds...) =
@@ -290,79 +820,277 @@ get(conn::Client, apt::AccessPoint, args...; kwds...) =
 get(conn::Client, apt::AbstractString, args...; kwds...) =
     get(conn, apt, join_arguments(args); kwds...)
 
+"""
+    XPA.get(f, args...; kwds...)
+
+calls `f(rep)` with `rep` the [`XPA.Reply`](@ref) returned by
+`XPA.get(args...; kwds...)` and returns the result of `f(rep)`.  This is
+intended to be used with the `do`-block syntax:
+
+```julia
+XPA.get(apt, args...; kwds...) do rep
+    ... # use the answer(s) in rep
+end
+```
+
+On return (or in case of errors), `rep` is released by
+[`XPA.release!`](@ref), so its storage is recycled for subsequent requests
+instead of being allocated for each of them.  The object `rep` must not be
+used after `f` returns.
+
+"""
+function get(f::Function, args...; kwds...)
+    rep = get(args...; kwds...)
+    try
+        return f(rep)
+    finally
+        release!(rep)
+    end
+end
+
 _get1(args...; kwds...) = get(args...; nmax = 1, throwerrors = true, kwds...)
+_get1(f::Function, args...; kwds...) =
+    get(f, args...; nmax = 1, throwerrors = true, kwds...)
 
 function get(::Type{Vector{T}},
-             args...; kwds...) :: Vector{T} where {T}
-    get_data(Vector{T}, _get1(args...; kwds...))
+             args...; text::Bool = false, kwds...) :: Vector{T} where {T}
+    _get1(args...; kwds...) do rep
+        get_data(Vector{T}, rep; text = text)
+    end
 end
 
 function get(::Type{Vector{T}}, dim::Integer,
              args...; kwds...) :: Vector{T} where {T}
-    get_data(Vector{T}, dim, _get1(args...; kwds...))
+    _get1(args...; kwds...) do rep
+        get_data(Vector{T}, dim, rep)
+    end
 end
 
 function get(::Type{Array{T}}, dim::Integer,
              args...; kwds...) :: Array{T,N} where {T,N}
-    get_data(Vector{T}, dim, _get1(args...; kwds...))
+    _get1(args...; kwds...) do rep
+        get_data(Vector{T}, dim, rep)
+    end
 end
 
 function get(::Type{Array{T}}, dims::NTuple{N,Integer},
              args...; kwds...) :: Array{T,N} where {T,N}
-    get_data(Array{T,N}, dims, _get1(args...; kwds...))
+    _get1(args...; kwds...) do rep
+        get_data(Array{T,N}, dims, rep)
+    end
 end
 
 function get(::Type{Array{T,N}}, dims::NTuple{N,Integer},
              args...; kwds...) :: Array{T,N} where {T,N}
-    get_data(Array{T,N}, dims, _get1(args...; kwds...))
+    _get1(args...; kwds...) do rep
+        get_data(Array{T,N}, dims, rep)
+    end
 end
 
 function get(::Type{String}, args...; kwds...)
-    return get_data(String, _get1(args...; kwds...))
+    _get1(args...; kwds...) do rep
+        get_data(String, rep)
+    end
 end
 
 function _get(conn::Client, apt::AbstractString, params::AbstractString,
               mode::AbstractString, nmax::Int, throwerrors::Bool,
-              users::Union{Nothing,AbstractString})
-    lengths = fill!(Vector{Csize_t}(undef, nmax), 0)
-    buffers = fill!(Vector{Ptr{Byte}}(undef, nmax*3), Ptr{Byte}(0))
-    address = pointer(buffers)
+              users::Union{Nothing,AbstractString}, async::Bool = false,
+              deadline::Float64 = Inf)
+    isfinite(deadline) && return _with_deadline(deadline, apt,
+                                                throwerrors) do c
+        _get(c, apt, params, mode, nmax, false, users, true)
+    end
+    users === nothing || return _merge(_resolve(conn, apt, users, nmax), nmax,
+                                       throwerrors) do addr
+        _get(conn, addr, params, mode, 1, false, nothing, async)
+    end
+    _fail_fast(apt) && return _finish!(_circuit_reply(apt), 1, apt,
+                                       throwerrors)
+    rep = _acquire_reply(nmax)
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    replies = (async ? _xpaget_threadcall(conn, apt, params, mode, rep) :
+                       _xpaget(conn, apt, params, mode, rep))
+    if _track!(conn, apt, rep, replies, true)
+        replies = (async ? _xpaget_threadcall(conn, apt, params, mode, rep) :
+                           _xpaget(conn, apt, params, mode, rep))
+        _track!(conn, apt, rep, replies, false)
+    end
+    _instrumented() && _record_client!(apt, params, time_ns() - t0, rep,
+                                       replies, 0)
+    return _finish!(rep, replies, apt, throwerrors)
+end
+
+# Call XPAGet to fill the answers in `rep`.  The `_threadcall` version runs
+# the call in a thread of libuv pool and lets other tasks run meanwhile.
+function _xpaget(conn::Client, apt::AbstractString, params::AbstractString,
+                 mode::AbstractString, rep::Reply)
+    nmax = _nmax(rep)
+    address = pointer(rep.buffers)
+    offset = nmax*sizeof(Ptr{Byte})
+    lock(_CLIENT_LOCK)
+    try
+        return GC.@preserve rep ccall(
+            (:XPAGet, libxpa), Cint,
+            (Ptr{Cvoid}, Cstring, Cstring, Cstring, Ptr{Ptr{Byte}},
+             Ptr{Csize_t}, Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
+            conn, apt, params, mode, address, rep.lengths,
+            address + offset, address + 2*offset, nmax)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
+end
+
+function _xpaget_threadcall(conn::Client, apt::AbstractString,
+                            params::AbstractString, mode::AbstractString,
+                            rep::Reply)
+    nmax = _nmax(rep)
+    address = pointer(rep.buffers)
     offset = nmax*sizeof(Ptr{Byte})
-    prevusers = _override_nsusers(users)
-    replies = ccall((:XPAGet, libxpa), Cint,
-                    (Client, Cstring, Cstring, Cstring, Ptr{Ptr{Byte}},
-                     Ptr{Csize_t}, Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
-                    conn, apt, params, mode, address, lengths,
-                    address + offset, address + 2*offset, nmax)
-    _restore_nsusers(prevusers)
-    0 ≤ replies ≤ nmax || error("unexpected number of replies from XPAGet")
-    rep = finalizer(_free, Reply(replies, lengths, buffers))
-    throwerrors && verify(rep; throwerrors=true)
+    lock(_CLIENT_LOCK)
+    try
+        return GC.@preserve conn rep @threadcall(
+            (:XPAGet, libxpa), Cint,
+            (Ptr{Cvoid}, Cstring, Cstring, Cstring, Ptr{Ptr{Byte}},
+             Ptr{Csize_t}, Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
+            conn.ptr, apt, params, mode, address, pointer(rep.lengths),
+            address + offset, address + 2*offset, nmax)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
+end
+
+# Terminate the processing of a request whose answers are in `rep`.
+function _finish!(rep::Reply, replies::Integer, apt::AbstractString,
+                  throwerrors::Bool)
+    0 ≤ replies ≤ _nmax(rep) || (release!(rep);
+                                 error("unexpected number of replies"))
+    rep.replies = replies
+    _check_address(apt, rep)
+    throwerrors && _verify_or_release(rep)
     return rep
 end
 
-# Override environment variable XPA_NSUSERS.
-_override_nsusers(::Nothing) = nothing
-_override_nsusers(users::AbstractString) = begin
-    prev = Base.get(ENV, "XPA_NSUSERS", "")
-    ENV["XPA_NSUSERS"] = users
-    return prev
+# When a list of users is specified, the access points matching a template
+# are resolved in Julia (from the list of access points known by the name
+# server, cached by `_listing`) and the request is sent to each of their
+# addresses.  This avoids modifying environment variable `XPA_NSUSERS` which
+# is global to the process and would hence serialize concurrent requests.
+function _resolve(conn::Client, apt::AbstractString, users::AbstractString,
+                  nmax::Int)
+    _is_address(apt) && return [String(apt)]
+    class, name = _split_ident(apt)
+    anyuser = false
+    owners = String[]
+    for user in split(users, (',', ' '); keepempty=false)
+        user == "*" && (anyuser = true)
+        push!(owners, user)
+    end
+    addrs = String[]
+    for ap in _listing(conn)
+        length(addrs) < nmax || break
+        if ((anyuser || ap.user ∈ owners) &&
+            _matches(class, ap.class) && _matches(name, ap.name) &&
+            ap.addr ∉ addrs)
+            push!(addrs, ap.addr)
+        end
+    end
+    return addrs
 end
 
-# Restore environment variable XPA_NSUSERS.
-_restore_nsusers(::Nothing) = nothing
-_restore_nsusers(users::AbstractString) = begin
-    if users == ""
-        delete!(ENV, "XPA_NSUSERS")
-    else
-        ENV["XPA_NSUSERS"] = users
+# Run `request(item)` for each item in `items` (for instance addresses) and
+# merge the answers.
+function _merge(request::Function, items::AbstractVector, nmax::Int,
+                throwerrors::Bool)
+    parts = Reply[]
+    try
+        for item in items
+            push!(parts, request(item)::Reply)
+        end
+    catch
+        foreach(release!, parts)
+        rethrow()
+    end
+    rep = _merge!(_acquire_reply(nmax), parts)
+    throwerrors && _verify_or_release(rep)
+    return rep
+end
+
+# Move the answers in `parts` to `rep` and release `parts`.
+function _merge!(rep::Reply, parts::AbstractVector{Reply})
+    m = _nmax(rep)
+    n = 0
+    for part in parts
+        p = _nmax(part)
+        for i in 1:length(part)
+            n < m || break
+            n += 1
+            rep.lengths[n] = part.lengths[i]
+            rep.maps[n] = part.maps[i]
+            part.maps[i] = _NOMAP
+            for k in 0:2
+                rep.buffers[n + k*m] = part.buffers[i + k*p]
+                part.buffers[i + k*p] = NULL
+            end
+            part.lengths[i] = 0
+        end
+        rep.shared |= part.shared
+        release!(part)
+    end
+    rep.replies = n
+    return rep
+end
+
+# Yield whether `str` matches the XPA template `pat` where `*` matches any
+# sequence of characters and `?` any single character.  As for XPA,
+# comparisons are case insensitive.
+function _matches(pat::AbstractString, str::AbstractString)
+    pat == "*" && return true
+    p, s = codeunits(pat), codeunits(str)
+    i, j = 1, 1
+    star, mark = 0, 0
+    while j ≤ length(s)
+        if i ≤ length(p) && (p[i] == UInt8('?') ||
+                             _lowercase(p[i]) == _lowercase(s[j]))
+            i += 1
+            j += 1
+        elseif i ≤ length(p) && p[i] == UInt8('*')
+            star, mark = i, j
+            i += 1
+        elseif star > 0
+            i = star + 1
+            j = (mark += 1)
+        else
+            return false
+        end
+    end
+    while i ≤ length(p) && p[i] == UInt8('*')
+        i += 1
     end
-    nothing
+    return i > length(p)
 end
 
+_lowercase(c::UInt8) = (UInt8('A') ≤ c ≤ UInt8('Z') ? c + 0x20 : c)
+
 function _free(rep::Reply)
     nmax = _nmax(rep)
+    if rep.shared
+        # Delete the files of shared memory descriptors which have not been
+        # mapped.  Other answers are not trusted to name files to delete.
+        for j in 1:length(rep)
+            rep.maps[j] === _NOMAP && _unlink_shared(rep.buffers[j],
+                                                     rep.lengths[j])
+        end
+        rep.shared = false
+    end
     fill!(rep.lengths, 0)
+    for i in 1:nmax
+        # Memory mapped buffers are unmapped when garbage collected.
+        if (m = rep.maps[i]) !== _NOMAP
+            rep.maps[i] = _NOMAP
+            rep.buffers[i] == pointer(m) && (rep.buffers[i] = NULL)
+        end
+    end
     for i in 0:2,
         j in 1:length(rep)
         k = i*nmax + j
@@ -373,6 +1101,81 @@ function _free(rep::Reply)
     end
 end
 
+"""
+    XPA.release!(rep)
+
+releases the resources associated with the answer(s) `rep` to an
+[`XPA.get`](@ref) or [`XPA.set`](@ref) request and recycles the storage of
+`rep` for subsequent requests.  After this call, `rep` must no longer be used.
+
+Calling `XPA.release!` is optional (resources are anyway released when `rep`
+is garbage collected) but it avoids allocating a new reply (and its buffers)
+for each request in loops of requests.
+The `do`-block forms of [`XPA.get`](@ref) and [`XPA.set`](@ref) automatically
+release the answer.
+
+"""
+function release!(rep::Reply)
+    _free(rep)
+    rep.replies = 0
+    nmax = _nmax(rep)
+    lock(_REPLY_POOL_LOCK)
+    try
+        pool = Base.get!(Vector{Reply}, _REPLY_POOL, nmax)
+        if length(pool) < _REPLY_POOL_SIZE && !_contains(pool, rep)
+            push!(pool, rep)
+        end
+    finally
+        unlock(_REPLY_POOL_LOCK)
+    end
+    return nothing
+end
+
+# Storage of released replies indexed by their maximum number of answers.
+# Pooled replies have a finalizer (registered once for all at creation) which
+# is only triggered if they are dropped.
+const _REPLY_POOL = Dict{Int,Vector{Reply}}()
+const _REPLY_POOL_LOCK = Threads.SpinLock()
+const _REPLY_POOL_SIZE = 16
+
+function _acquire_reply(nmax::Int)
+    rep = nothing
+    lock(_REPLY_POOL_LOCK)
+    try
+        pool = Base.get(_REPLY_POOL, nmax, nothing)
+        if pool !== nothing && !isempty(pool)
+            rep = pop!(pool)
+        end
+    finally
+        unlock(_REPLY_POOL_LOCK)
+    end
+    return (rep === nothing ? _new_reply(nmax) : rep)
+end
+
+_new_reply(nmax::Int) =
+    finalizer(_free, Reply(0, fill!(Vector{Csize_t}(undef, nmax), 0),
+                           fill!(Vector{Ptr{Byte}}(undef, nmax*3), NULL),
+                           fill!(Vector{Vector{Byte}}(undef, nmax), _NOMAP),
+                           false))
+
+function _contains(pool::Vector{Reply}, rep::Reply)
+    for x in pool
+        x === rep && return true
+    end
+    return false
+end
+
+# Throw an exception for the first error in `rep` (if any) after having
+# released `rep`.
+function _verify_or_release(rep::Reply)
+    try
+        verify(rep; throwerrors=true)
+    catch
+        release!(rep)
+        rethrow()
+    end
+end
+
 # i-th server name is at index i + nmax.
 _get_srv(rep::Reply, i::Integer) = _get_srv(rep, Int(i))
 _get_srv(rep::Reply, i::Int) :: Ptr{Byte} =
@@ -393,6 +1196,9 @@ function _get_buf(rep::Reply, i::Int, preserve::Bool) :: Tuple{Ptr{Byte},Int}
         ptr, len = rep.buffers[i], rep.lengths[i]
         (ptr == NULL ? len == 0 : len ≥ 0) || error("invalid buffer length")
         if ! preserve && ptr != NULL
+            # The caller takes ownership of a dynamically allocated buffer, so
+            # memory mapped data is copied.
+            rep.maps[i] === _NOMAP || (ptr = _unmap!(rep, i))
             rep.lengths[i] = 0
             rep.buffers[i] = NULL
         end
@@ -424,7 +1230,7 @@ answers to a get/set request.  The result is `n` if `n ≥ 1` or
 the maximum number of answer that can be stored in `rep`.
 
 """
-_nmax(n::Integer) = (n == -1 ? Int(getconfig("XPA_MAXHOSTS")) : Int(n))
+_nmax(n::Integer) = (n == -1 ? _CONFIG[].maxhosts : Int(n))
 _nmax(rep::Reply) = length(rep.lengths)
 
 
@@ -477,14 +1283,17 @@ function Base.show(io::IO, rep::Reply)
         for i in 1:n
             # Check whether all bytes in the data buffer are printable ASCII
             # characters.
-            print(io, "  ", i, ": server = ",
-                  repr(get_server(rep, i); context=io), ", message = ",
-                  repr(get_message(rep, i); context=io), ", data = ")
-            ptr, len = _get_buf(rep, i, true)
+            ans = @inbounds rep[i]
+            print(io, "  ", i, ": server = ")
+            show(io, ans.server)
+            print(io, ", message = ")
+            show(io, ans.message)
+            print(io, ", data = ")
+            ptr, len = pointer(ans.data), sizeof(ans.data)
             if ptr == C_NULL
                 print(io, "NULL")
             elseif len == 0
-                print(io, repr("";  context=io))
+                show(io, "")
             else
                 cstring = true
                 for j in 1:len
@@ -502,7 +1311,7 @@ function Base.show(io::IO, rep::Reply)
                     end
                 end
                 if cstring
-                    print(io, repr(unsafe_string(ptr, len);  context=io))
+                    show(io, ans.data)
                 else
                     print(io, len, (len > 1 ? " bytes" : " byte"))
                 end
@@ -521,8 +1330,9 @@ See also [`XPA.get`](@ref), [`XPA.has_error`](@ref), [`XPA.get_message`](@ref).
 
 """
 function has_errors(rep::Reply) :: Bool
+    nmax = _nmax(rep)
     for i in 1:length(rep)
-        if has_error(rep, i)
+        if _message_status(rep.buffers[i + 2*nmax]) == _ERROR_STATUS
             return true
         end
     end
@@ -555,6 +1365,94 @@ function _startswith(ptr::Ptr{Byte}, tup::NTuple{N,Byte}) where {N}
     return true
 end
 
+# Classify the message at `ptr`, both prefixes start with `XPA\$`.
+const _OK_STATUS      = 0
+const _MESSAGE_STATUS = 1
+const _ERROR_STATUS   = 2
+function _message_status(ptr::Ptr{Byte})
+    ptr == NULL && return _OK_STATUS
+    for i in 1:4
+        unsafe_load(ptr, i) == _XPA_ERROR[i] || return _OK_STATUS
+    end
+    c = unsafe_load(ptr, 5)
+    if c == _XPA_ERROR[5]
+        for i in 6:length(_XPA_ERROR)
+            unsafe_load(ptr, i) == _XPA_ERROR[i] || return _OK_STATUS
+        end
+        return _ERROR_STATUS
+    elseif c == _XPA_MESSAGE[5]
+        for i in 6:length(_XPA_MESSAGE)
+            unsafe_load(ptr, i) == _XPA_MESSAGE[i] || return _OK_STATUS
+        end
+        return _MESSAGE_STATUS
+    end
+    return _OK_STATUS
+end
+
+Base.eltype(::Type{Reply}) = Answer
+Base.firstindex(rep::Reply) = 1
+Base.lastindex(rep::Reply) = length(rep)
+Base.eachindex(rep::Reply) = Base.OneTo(length(rep))
+
+@inline function Base.iterate(rep::Reply, i::Int = 1)
+    i > length(rep) && return nothing
+    return (@inbounds(rep[i]), i + 1)
+end
+
+@inline function Base.getindex(rep::Reply, i::Integer)
+    @boundscheck 1 ≤ i ≤ length(rep) || throw(BoundsError(rep, i))
+    nmax = _nmax(rep)
+    @inbounds begin
+        srv = StringView(rep.buffers[i + nmax])
+        msg = StringView(rep.buffers[i + 2*nmax])
+        dat = StringView(rep.buffers[i], Int(rep.lengths[i]))
+    end
+    return Answer(i, srv, msg, dat)
+end
+
+has_error(ans::Answer) =
+    _message_status(pointer(ans.message)) == _ERROR_STATUS
+has_message(ans::Answer) =
+    _message_status(pointer(ans.message)) == _MESSAGE_STATUS
+get_server(ans::Answer) = String(ans.server)
+get_message(ans::Answer) = String(ans.message)
+
+Base.show(io::IO, ans::Answer) =
+    print(io, "XPA.Answer(", ans.index, ", server = ", repr(ans.server),
+          ", message = ", repr(ans.message), ", ", sizeof(ans.data),
+          (sizeof(ans.data) > 1 ? " bytes" : " byte"), " of data)")
+
+"""
+    XPA.classify(rep) -> (ok, messages, errors)
+
+sorts in a single pass the answers in `rep` according to their status and
+yields 3 sets of indices: `ok` for the answers without message, `messages`
+for the answers with an informative message and `errors` for the answers with
+an error message (see [`XPA.has_message`](@ref) and
+[`XPA.has_error`](@ref)).  No strings are built, so this is much faster than
+calling `XPA.get_message` for each answer when there are many servers.  The
+sets are instances of `BitSet`, call:
+
+    XPA.classify!(ok, messages, errors, rep)
+
+to avoid allocating them.
+
+"""
+classify(rep::Reply) = classify!(BitSet(), BitSet(), BitSet(), rep)
+
+function classify!(ok::BitSet, messages::BitSet, errors::BitSet, rep::Reply)
+    empty!(ok)
+    empty!(messages)
+    empty!(errors)
+    nmax = _nmax(rep)
+    for i in 1:length(rep)
+        status = _message_status(rep.buffers[i + 2*nmax])
+        push!((status == _ERROR_STATUS ? errors :
+               status == _MESSAGE_STATUS ? messages : ok), i)
+    end
+    return (ok, messages, errors)
+end
+
 """
     XPA.verify(rep [, i]; throwerrors::Bool=false) -> boolean
 
@@ -605,6 +1503,11 @@ returned value depends on the optional leading arguments `T` and `dims`:
   `Array{S}` or `Array{S,N}` and `dims` a list of `N` dimensions to retrieve
   the data as an array of type `Array{S,N}`.
 
+* If `T` is a numeric type like `Float64` or `NTuple{N,S}` or if `T` is
+  `Vector{S}` and keyword `text` is true, the data are decoded as numbers
+  written in textual form (see [`XPA.get`](@ref)) and the data buffer is
+  always preserved.
+
 Keyword `preserve` can be used to specifiy whether or not to preserve the
 internal data buffer in `rep` for another call to `XPA.get_data`.  By default,
 `preserve=true` when `T = String` is specified and `preserve=false` otherwise.
@@ -629,8 +1532,14 @@ function get_data(::Type{String}, rep::Reply, i::Integer=1;
 end
 
 function get_data(::Type{Vector{T}}, rep::Reply, i::Integer=1;
-                  preserve::Bool = false) :: Vector{T} where {T}
+                  preserve::Bool = false,
+                  text::Bool = false) :: Vector{T} where {T}
+    text && return _decode_vector(T, rep, i)
     isbitstype(T) || error("invalid Array element type")
+    if !preserve && _mapping(rep, i) !== nothing
+        m = _take_mapping!(rep, i)
+        return _wrap_mapping(Vector{T}, m, (div(length(m), sizeof(T)),))
+    end
     ptr, len = _get_buf(rep, i, preserve)
     cnt = div(len, sizeof(T))
     if ptr == NULL || cnt ≤ 0
@@ -669,6 +1578,53 @@ function get_data(::Type{Array{T,N}}, dims::NTuple{N,Integer},
     return _get_buf(Array{T,N}, _dimensions(dims), rep, i, preserve)
 end
 
+"""
+    XPA.get!(dest, [conn,] apt, args...; framed=false, kwds...) -> dest
+
+retrieves data from the XPA access point `apt` with arguments `args...` and
+stores it in the existing dense array `dest`.  Arguments and keywords are as
+for [`XPA.get`](@ref) with the type `T` specified (a single answer and no
+errors are expected).  The bytes of the answer are copied into `dest`, see
+[`XPA.get_data!`](@ref) for details and keyword `framed`.  As the storage of
+the answer is recycled (see [`XPA.release!`](@ref)), this is the way to
+retrieve data repeatedly in a loop without allocating a new array for each
+request.
+
+"""
+get!(dest::DenseArray, args...; framed::Bool = false, kwds...) =
+    _get1(args...; kwds...) do rep
+        get_data!(dest, rep; framed = framed)
+    end
+
+"""
+    XPA.get_data!(dest, rep, i=1; framed=false) -> dest
+
+copies the data associated with the `i`-th reply in XPA answer `rep` into the
+dense array `dest` whose elements must be of a bits type and yields `dest`.
+The data buffer is preserved in `rep`.  An error is thrown if the data buffer
+is too small for `dest` (extra bytes are ignored).
+
+If keyword `framed` is true, the answer must be a framed array (see
+[`XPA.get`](@ref) with `T = Array`) whose element type and dimensions are
+those of `dest`.  The bytes of the elements are swapped if the byte order of
+the server is not the same as that of the client.
+
+This is the client counterpart of `copyto!(dest, buf)` for a receive buffer
+in a server (see [`XPA.ReceiveBuffer`](@ref)).  See also
+[`XPA.get_data`](@ref) and [`XPA.get!`](@ref).
+
+"""
+function get_data!(dest::DenseArray{T}, rep::Reply, i::Integer = 1;
+                   framed::Bool = false) where {T}
+    isbitstype(T) || error("invalid Array element type")
+    ptr, len = _get_buf(rep, i, true)
+    framed && return _copy_framed!(dest, ptr, len)
+    nbytes = sizeof(dest)
+    nbytes ≤ len || error("data buffer is too small for array")
+    nbytes > 0 && _memcpy!(dest, ptr, nbytes)
+    return dest
+end
+
 """
 
 Private method `_get_buf(rep,i,preserve)` yields `(ptr,len)` the address and
@@ -692,6 +1648,11 @@ function _get_buf(::Type{Array{T,N}}, dims::NTuple{N,Int},
                   rep::Reply, i::Int, preserve::Bool) :: Array{T,N} where {T,N}
     isbitstype(T) || error("invalid Array element type")
     minimum(dims) ≥ 0 || error("invalid Array dimensions")
+    if !preserve && (m = _mapping(rep, i)) !== nothing
+        prod(dims)*sizeof(T) ≤ length(m) ||
+            error("Array size too large for buffer")
+        return _wrap_mapping(Array{T,N}, _take_mapping!(rep, i), dims)
+    end
     ptr, len = _get_buf(rep, i, preserve)
     cnt = prod(dims)
     cnt*sizeof(T) ≤ len || error("Array size too large for buffer")
@@ -717,6 +1678,285 @@ _dimensions(dims::TupleOf{Int}) = dims
 # string is returned.
 _string(ptr::Ptr{Byte}) = (ptr == NULL ? "" : unsafe_string(ptr))
 
+"""
+    XPA.getmany(apts, args...; timeout=Inf, deadline=Inf, pool=XPA.connection_pool(), kwds...)
+
+concurrently retrieves data from the XPA access points in the list `apts` (see
+[`XPA.get`](@ref) for the other arguments and keywords).  Requests are
+spawned as tasks which can be run by any Julia thread, each one with its own
+client connection taken from `pool` (see [`XPA.ConnectionPool`](@ref)).  The
+result is a vector of [`XPA.Reply`](@ref) in the same order as `apts`.
+
+Keyword `timeout` specifies the maximum number of seconds to wait for the
+answers, keyword `deadline` the time (as given by `time()`) at which all
+answers must have been received.  If no answer is received in time from the
+access point `apts[i]`, the `i`-th reply has a single answer with an error
+message and the request is abandoned (its result will be discarded).  The
+deadline is applied to each request as by [`XPA.get`](@ref), so the requests
+are run in the thread pool of libuv (see `@threadcall`) and do not block the
+Julia threads.  Without a timeout or a deadline, requests block the thread
+running their task.  In any case, the calls to the XPA library, which is not
+thread-safe, are serialized: the requests are sent one after the other and
+the benefit is that the caller and the other tasks are not blocked.
+
+See also [`XPA.setmany`](@ref).
+
+"""
+getmany(apts::AbstractVector, args...; kwds...) = _many(get, apts, args...; kwds...)
+
+"""
+    XPA.setmany(apts, args...; data=nothing, timeout=Inf, deadline=Inf, pool=XPA.connection_pool(), kwds...)
+
+concurrently sends `data` to the XPA access points in the list `apts` (see
+[`XPA.set`](@ref) for the other arguments and keywords).  Requests are
+processed as by [`XPA.getmany`](@ref) and the result is a vector of
+[`XPA.Reply`](@ref) in the same order as `apts`.
+
+"""
+setmany(apts::AbstractVector, args...; kwds...) = _many(set, apts, args...; kwds...)
+
+function _many(func::Function, apts::AbstractVector, args...;
+               timeout::Real = Inf,
+               deadline::Real = Inf,
+               pool::ConnectionPool = _POOL,
+               kwds...)
+    deadline = _deadline(timeout, deadline)
+    tasks = [Threads.@spawn(_with_connection(func, pool, apt, args...;
+                                             deadline = deadline, kwds...))
+             for apt in apts]
+    replies = Vector{Reply}(undef, length(tasks))
+    for i in eachindex(tasks, replies)
+        replies[i] = _fetch(tasks[i], deadline, apts[i])
+    end
+    return replies
+end
+
+"""
+    XPA.batch(f, [conn,] apt; ack=true, mode="", throwerrors=false) -> rep
+
+calls `f(b)` to queue commands in the batch `b` and sends them in order to
+the XPA access point `apt`, back to back on the same client connection.  The
+result is a single [`XPA.Reply`](@ref) with the answers to all the commands,
+in order (see [`XPA.release!`](@ref)).  Commands are queued in the function
+`f` by:
+
+    XPA.set(b, args...; data=nothing)
+
+with the same arguments as [`XPA.set`](@ref).  Example:
+
+    XPA.batch("DS9:ds9") do b
+        XPA.set(b, "zoom", 2)
+        XPA.set(b, "pan to", 100, 200)
+        XPA.set(b, "scale log")
+    end
+
+The access point is resolved once for all the commands (see
+[`XPA.address`](@ref)).  If keyword `ack` is false, the client does not wait
+for the acknowledgment of each command by the server which saves a round
+trip per command, but errors are not reported.  Keywords `mode` and
+`throwerrors` are as for [`XPA.set`](@ref), `nmax` is always 1 in a batch.
+The data of the commands is not copied, it must not be modified before
+`XPA.batch` returns.
+
+"""
+batch(f::Function, apt::Union{AbstractString,AccessPoint}; kwds...) =
+    batch(f, connection(), apt; kwds...)
+
+function batch(f::Function, conn::Client,
+               apt::Union{AbstractString,AccessPoint};
+               ack::Bool = true,
+               mode::AbstractString = "",
+               throwerrors::Bool = false)
+    b = Batch(conn, address(apt), String[], Any[])
+    f(b)
+    ack || (mode = (isempty(mode) ? "ack=false" : mode*",ack=false"))
+    n = length(b.params)
+    return _merge(1:n, max(n, 1), throwerrors) do i
+        _set(conn, b.apt, b.params[i], mode, b.data[i], 1, false, nothing)
+    end
+end
+
+function set(b::Batch, args::Union{AbstractString,Real}...; data = nothing)
+    push!(b.params, join_arguments(args))
+    push!(b.data, buffer(data isa IO ? read(data) : data))
+    return b
+end
+
+Base.length(b::Batch) = length(b.params)
+
+"""
+    XPA.bind([conn,] ident; user="*", mode="") -> h
+
+resolves once the XPA access point identified by `ident` (a string of the
+form `CLASS:NAME`) and yields a handle `h`, an instance of
+[`XPA.Target`](@ref), which binds the access point to the client connection
+`conn` (a per-task connection by default, see [`XPA.connection`](@ref)).
+Keyword `user` is as for [`XPA.find`](@ref) and keyword `mode` specifies the
+default mode of the requests.
+
+The handle is used in place of `conn` and `apt` in the calls:
+
+    XPA.get([T, [dims,]] h, args...; kwds...)
+    XPA.set(h, args...; data=nothing, kwds...)
+
+which are sent directly to the address of the access point, without querying
+the name server nor parsing the access point.  If a request fails to reach
+the server (no answers or a connection error, see [`XPA.health`](@ref)), the
+access point is resolved again and, if its address
+has changed (for instance because the server has been restarted on another
+port), the request is sent again to the new address.  Requests whose data is
+an `IO` object are never sent again.
+
+"""
+bind(ident::AbstractString; kwds...) = bind(connection(), ident; kwds...)
+
+function bind(conn::Client, ident::AbstractString;
+              user::AbstractString = "*",
+              mode::AbstractString = "")
+    apt = find(conn, ident; user = user, throwerrors = true)
+    return Target(conn, ident, user, mode, apt)
+end
+
+address(h::Target) = h.apt.addr
+
+Base.show(io::IO, h::Target) =
+    print(io, "XPA.Target(\"", h.ident, "\" => \"", h.apt.addr, "\")")
+
+function get(h::Target, args::Union{AbstractString,Real}...;
+             mode::AbstractString = h.mode,
+             throwerrors::Bool = false,
+             kwds...)
+    return _retarget(h, throwerrors) do addr
+        get(h.conn, addr, args...; mode = mode, throwerrors = false, kwds...)
+    end
+end
+
+function set(h::Target, args::Union{AbstractString,Real}...;
+             mode::AbstractString = h.mode,
+             throwerrors::Bool = false,
+             data = nothing,
+             kwds...)
+    return _retarget(h, throwerrors, !(data isa IO)) do addr
+        set(h.conn, addr, args...; mode = mode, data = data,
+            throwerrors = false, kwds...)
+    end
+end
+
+# Run `request(addr)` with the address of `h`.  If this fails to reach the
+# server and the address of the access point has changed, run the request
+# again with the new address.  Errors answered by the server are returned.
+function _retarget(request::Function, h::Target, throwerrors::Bool,
+                   retry::Bool = true)
+    rep = request(h.apt.addr)::Reply
+    if retry && _failed(rep, length(rep)) && _rebind!(h)
+        release!(rep)
+        rep = request(h.apt.addr)::Reply
+    end
+    throwerrors && _verify_or_release(rep)
+    return rep
+end
+
+# Resolve again the access point of `h`, yielding whether its address has
+# changed.
+function _rebind!(h::Target)
+    invalidate!(_NAMECACHE, h.apt)
+    apt = find(h.conn, h.ident; user = h.user)
+    (apt === nothing || apt.addr == h.apt.addr) && return false
+    h.apt = apt
+    return true
+end
+
+# Wait for the result of a request until a deadline.  If `tracked` is true,
+# the request runs in a thread of libuv pool and is counted in `_ABANDONED`
+# if abandoned.
+function _fetch(task::Task, deadline::Float64, apt, tracked::Bool = false)
+    if isfinite(deadline) && !istaskdone(task)
+        # Sleep until the task completes or a single timer expires, whichever
+        # comes first.
+        done = Channel{Bool}(2)
+        timer = Timer(_ -> put!(done, false), max(deadline - time(), 0.0))
+        @async begin
+            try
+                wait(task)
+            catch
+                nothing
+            end
+            put!(done, true)
+        end
+        completed = take!(done)
+        close(timer)
+        if !completed
+            _abandon(task, tracked)
+            return _error_reply(apt, "request timed out")
+        end
+    end
+    return fetch(task)::Reply
+end
+
+# Number of abandoned requests still running in libuv pool.  New requests
+# with a deadline fail fast while there are `_CONFIG[].maxabandoned` or more
+# such requests.
+const _ABANDONED = Threads.Atomic{Int}(0)
+
+# Yield the time at which a request must be complete given keywords `timeout`
+# (relative) and `deadline` (absolute).
+function _deadline(timeout::Real, deadline::Real)
+    timeout ≥ 0 || throw(ArgumentError("timeout must be nonnegative"))
+    return (isfinite(timeout) ? min(Float64(deadline), time() + timeout) :
+            Float64(deadline))
+end
+
+# Run `func(conn)` in a task with a connection taken from the pool and wait
+# for its answer until `deadline`.  The request shall be run by
+# `@threadcall` so that the calling task can be resumed when the deadline
+# expires.
+function _with_deadline(func::Function, deadline::Float64, apt,
+                        throwerrors::Bool)
+    time() < deadline || return _finish!(
+        _error_reply(apt, "request timed out"), 1, apt, throwerrors)
+    _ABANDONED[] < _CONFIG[].maxabandoned || return _finish!(
+        _error_reply(apt, "too many abandoned requests in progress"), 1,
+        apt, throwerrors)
+    task = Threads.@spawn _with_connection(func, _POOL)
+    rep = _fetch(task, deadline, apt, true)
+    throwerrors && _verify_or_release(rep)
+    return rep
+end
+
+# Release the result of an abandoned request when it completes.
+function _abandon(task::Task, tracked::Bool = false)
+    tracked && Threads.atomic_add!(_ABANDONED, 1)
+    @async try
+        release!(fetch(task)::Reply)
+    catch
+        nothing
+    finally
+        tracked && Threads.atomic_sub!(_ABANDONED, 1)
+    end
+end
+
+# Build a reply with a single answer made of an error message.
+function _error_reply(apt, msg::AbstractString)
+    srv = (apt isa AccessPoint ? apt.class*":"*apt.name*" "*apt.addr :
+           string(apt))
+    rep = _acquire_reply(1)
+    nmax = _nmax(rep)
+    rep.buffers[1 + nmax] = _strdup(srv)
+    rep.buffers[1 + 2*nmax] = _strdup(_XPA_ERROR_PREFIX*msg*" ("*srv*")\n")
+    rep.replies = 1
+    return rep
+end
+
+# Make a dynamically allocated copy of a string.
+function _strdup(str::AbstractString)
+    s = String(str)
+    len = sizeof(s)
+    ptr = _malloc(len + 1)
+    GC.@preserve s _memcpy!(ptr, Base.unsafe_convert(Ptr{Byte}, s), len)
+    unsafe_store!(ptr, zero(Byte), len + 1)
+    return ptr
+end
+
 """
     XPA.set([conn,] apt, args...; data=nothing, kwds...) -> rep
 
@@ -724,14 +1964,17 @@ sends `data` to one or more XPA access points identified by `apt` with
 arguments `args...` (automatically converted into a single string where the
 arguments are separated by a single space).  The result is an instance of
 [`XPA.Reply`](@ref).  Optional argument `conn` is a persistent XPA client
-connection (created by [`XPA.Client`](@ref)); if omitted, a per-thread
+connection (created by [`XPA.Client`](@ref)); if omitted, a per-task
 connection is used (see [`XPA.connection`](@ref)).
 
 The following keywords are available:
 
-* Keyword `data` specifies the data to send, may be `nothing`, an array or a
-  string.  If it is an array, it must have contiguous elements (as a for a
-  *dense* array) and must implement the `pointer` method.
+* Keyword `data` specifies the data to send, may be `nothing`, an array, a
+  string or an `IO` object.  If it is an array, it must have contiguous
+  elements (as a for a *dense* array) and must implement the `pointer` method.
+  If it is an `IO` object, the data are read until the end of the stream.  An
+  `IOStream` (e.g. an open file) is directly read by the XPA library (by
+  `XPASetFd`) by chunks, other `IO` objects are read into a buffer.
 
 * Keyword `nmax` specifies the maximum number of recipients, `nmax=1` by
   default.  Specify `nmax=-1` to use the maximum possible number of XPA hosts.
@@ -743,12 +1986,33 @@ The following keywords are available:
   in the list of answers.  By default, `throwerrors` is false.
 
 * Keyword `users` specifies the list of possible users owning the access-point.
-  This (temporarily) overrides the settings in environment variable
-  `XPA_NSUSERS`.  By default and if the environment variable `XPA_NSUSERS` is
-  not set, the access-point must be owned the caller (see Section
-  *Distinguishing Users* in XPA documentation).  The value is a string wich may
-  be a list of comma separated user names or `"*"` to access all users on a
-  given machine.
+  This overrides the settings in environment variable `XPA_NSUSERS` for this
+  request.  By default and if the environment variable `XPA_NSUSERS` is not
+  set, the access-point must be owned the caller (see Section *Distinguishing
+  Users* in XPA documentation).  The value is a string wich may be a list of
+  comma separated user names or `"*"` to access all users on a given machine.
+  The matching access points are found from the list of access points known by
+  the name server (cached as explained in [`XPA.namecache`](@ref)) and the
+  request is sent to each of them, so concurrent requests with different users
+  do not interfere.
+
+* Keyword `compress` specifies whether to compress the data sent to the
+  server(s), `compress=false` by default.  As for [`XPA.get`](@ref), this is
+  only possible with servers implemented with the Julia XPA package which
+  decompress the data before calling their receive callback.  Data sent by an
+  `IO` object are not compressed.
+
+* Keywords `timeout` and `deadline` limit the duration of the request as for
+  [`XPA.get`](@ref), including the limit set by
+  `XPA.getconfig("XPA_MAXABANDONED")` on the number of abandoned requests.
+  They are ignored if `data` is an `IO` object.  The contents of `data` must
+  not be modified before an abandoned request completes.
+
+* Keyword `retry` specifies whether the request may be sent again, after
+  having re-open the client connection, if the server could not be reached
+  while the previous request to the same access point succeeded (see
+  [`XPA.health`](@ref)).  This is false by default because the command may
+  not be idempotent and may have been executed by the server.
 
 See also [`XPA.Client`](@ref), [`XPA.get`](@ref) and [`XPA.verify`](@ref).
 
@@ -760,42 +2024,254 @@ function set(conn::Client,
              mode::AbstractString = "",
              nmax::Integer = 1,
              throwerrors::Bool = false,
-             users::Union{Nothing,AbstractString} = nothing)
-    return _set(conn, apt, cmd, mode, buffer(data), _nmax(nmax),
-                throwerrors, users)
+             users::Union{Nothing,AbstractString} = nothing,
+             compress::Bool = false,
+             timeout::Real = Inf,
+             deadline::Real = Inf,
+             retry::Bool = false)
+    if data isa IO
+        return _setfd(conn, apt, cmd, mode, data, _nmax(nmax), throwerrors,
+                      users)
+    end
+    buf = buffer(data)
+    if compress
+        cmd = _options_prefix(_OPTION_LZ4)*cmd
+        zptr, zlen = GC.@preserve buf _compress(
+            Ptr{Byte}(pointer(buf)), sizeof(buf))
+        if zptr != NULL
+            buf = unsafe_wrap(Array, zptr, zlen, own=true)
+        end
+    end
+    return _set(conn, apt, cmd, mode, buf, _nmax(nmax), throwerrors, users,
+                false, _deadline(timeout, deadline), retry)
 end
 
 function set(conn::Client,
              apt::AbstractString,
              args::Union{AbstractString,Real}...;
              kwds...)
-    return _set(conn, apt, join_arguments(args); kwds...)
+    return set(conn, apt, join_arguments(args); kwds...)
 end
 
 set(apt::AbstractString, args::Union{AbstractString,Real}...; kwds...) =
     set(connection(), apt, join_arguments(args); kwds...)
 
+set(apt::AccessPoint, args...; kwds...) =
+    set(address(apt), args...; kwds...)
+
+set(conn::Client, apt::AccessPoint, args...; kwds...) =
+    set(conn, address(apt), args...; kwds...)
+
+"""
+    XPA.set(f, args...; kwds...)
+
+calls `f(rep)` with `rep` the [`XPA.Reply`](@ref) returned by
+`XPA.set(args...; kwds...)`, releases `rep` by [`XPA.release!`](@ref) and
+returns the result of `f(rep)`.  This is intended to be used with the
+`do`-block syntax.
+
+See also [`XPA.get`](@ref).
+
+"""
+function set(f::Function, args...; kwds...)
+    rep = set(args...; kwds...)
+    try
+        return f(rep)
+    finally
+        release!(rep)
+    end
+end
+
 function _set(conn::Client, apt::AbstractString, params::AbstractString,
               mode::AbstractString, data::Union{NullBuffer,DenseArray},
               nmax::Int, throwerrors::Bool,
-              users::Union{Nothing,AbstractString})
-    lengths = fill!(Vector{Csize_t}(undef, nmax), 0)
-    buffers = fill!(Vector{Ptr{Byte}}(undef, nmax*3), Ptr{Byte}(0))
-    address = pointer(buffers)
+              users::Union{Nothing,AbstractString}, async::Bool = false,
+              deadline::Float64 = Inf, retry::Bool = false)
+    isfinite(deadline) && return _with_deadline(deadline, apt,
+                                                throwerrors) do c
+        _set(c, apt, params, mode, data, nmax, false, users, true, Inf, retry)
+    end
+    users === nothing || return _merge(_resolve(conn, apt, users, nmax), nmax,
+                                       throwerrors) do addr
+        _set(conn, addr, params, mode, data, 1, false, nothing, async, Inf,
+             retry)
+    end
+    _fail_fast(apt) && return _finish!(_circuit_reply(apt), 1, apt,
+                                       throwerrors)
+    rep = _acquire_reply(nmax)
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    replies = (async ? _xpaset_threadcall(conn, apt, params, mode, data, rep) :
+                       _xpaset(conn, apt, params, mode, data, rep))
+    if _track!(conn, apt, rep, replies, retry)
+        replies = (async ? _xpaset_threadcall(conn, apt, params, mode, data, rep) :
+                           _xpaset(conn, apt, params, mode, data, rep))
+        _track!(conn, apt, rep, replies, false)
+    end
+    _instrumented() && _record_client!(apt, params, time_ns() - t0, rep,
+                                       replies, sizeof(data))
+    return _finish!(rep, replies, apt, throwerrors)
+end
+
+# Call XPASet and store the answers in `rep`.  See `_xpaget`.
+function _xpaset(conn::Client, apt::AbstractString, params::AbstractString,
+                 mode::AbstractString, data::Union{NullBuffer,DenseArray},
+                 rep::Reply)
+    nmax = _nmax(rep)
+    address = pointer(rep.buffers)
     offset = nmax*sizeof(Ptr{Byte})
-    prevusers = _override_nsusers(users)
-    replies = ccall((:XPASet, libxpa), Cint,
-              (Client, Cstring, Cstring, Cstring, Ptr{Cvoid},
-               Csize_t, Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
-              conn, apt, params, mode, data, sizeof(data),
-                    address + offset, address + 2*offset, nmax)
-    _restore_nsusers(prevusers)
-    0 ≤ replies ≤ nmax || error("unexpected number of replies from XPASet")
-    rep = finalizer(_free, Reply(replies, lengths, buffers))
-    throwerrors && verify(rep; throwerrors=true)
-    return rep
+    lock(_CLIENT_LOCK)
+    try
+        return GC.@preserve rep ccall(
+            (:XPASet, libxpa), Cint,
+            (Ptr{Cvoid}, Cstring, Cstring, Cstring, Ptr{Cvoid},
+             Csize_t, Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
+            conn, apt, params, mode, data, sizeof(data),
+            address + offset, address + 2*offset, nmax)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
+end
+
+function _xpaset_threadcall(conn::Client, apt::AbstractString,
+                            params::AbstractString, mode::AbstractString,
+                            data::Union{NullBuffer,DenseArray}, rep::Reply)
+    nmax = _nmax(rep)
+    address = pointer(rep.buffers)
+    offset = nmax*sizeof(Ptr{Byte})
+    lock(_CLIENT_LOCK)
+    try
+        return GC.@preserve conn data rep @threadcall(
+            (:XPASet, libxpa), Cint,
+            (Ptr{Cvoid}, Cstring, Cstring, Cstring, Ptr{Cvoid},
+             Csize_t, Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
+            conn.ptr, apt, params, mode, Base.unsafe_convert(Ptr{Cvoid}, data),
+            sizeof(data), address + offset, address + 2*offset, nmax)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
+end
+
+"""
+    XPA.get(io, [conn,] apt, args...; kwds...) -> rep
+
+writes to `io` the data sent by the XPA server(s) identified by `apt` in
+response to a request with arguments `args...`.  The result `rep` is an
+instance of [`XPA.Reply`](@ref) with the server name(s) and message(s) for
+each answer but no data.  Keywords are the same as for [`XPA.get`](@ref).
+
+If `io` is an `IOStream` (e.g. an open file), the data are directly written by
+the XPA library (by `XPAGetFd`) as they are received, there is no intermediate
+buffer whatever the size of the data.  Otherwise, or if any of the keywords
+`compress`, `shm`, `timeout` or `deadline` is specified, the data of each
+answer is received in a buffer (possibly memory mapped) and then written to
+`io`.  For example:
+
+```julia
+open("image.fits", "w") do io
+    XPA.get(io, "DS9:*", "fits"; throwerrors=true)
+end
+```
+
+"""
+get(io::IO, apt::Union{AbstractString,AccessPoint}, args...; kwds...) =
+    get(io, connection(), apt, args...; kwds...)
+
+function get(io::IO, conn::Client,
+             apt::Union{AbstractString,AccessPoint}, args...;
+             mode::AbstractString = "",
+             nmax::Integer = 1,
+             throwerrors::Bool = false,
+             users::Union{Nothing,AbstractString} = nothing,
+             compress::Bool = false,
+             shm::Bool = false,
+             timeout::Real = Inf,
+             deadline::Real = Inf)
+    addr = (apt isa AccessPoint ? address(apt) : apt)
+    params = join_arguments(args)
+    deadline = _deadline(timeout, deadline)
+    if io isa IOStream && !compress && !shm && !isfinite(deadline)
+        flush(io)
+        return _getfd(conn, addr, params, mode, _fd(io), _nmax(nmax),
+                      throwerrors, users)
+    else
+        rep = get(conn, addr, params; mode = mode, nmax = nmax,
+                  throwerrors = throwerrors, users = users,
+                  compress = compress, shm = shm, deadline = deadline)
+        for i in 1:length(rep)
+            if _mapping(rep, i) !== nothing
+                write(io, _take_mapping!(rep, i))
+                continue
+            end
+            ptr, len = _get_buf(rep, i, false)
+            try
+                ptr == NULL || unsafe_write(io, ptr, len)
+            finally
+                _free(ptr)
+            end
+        end
+        return rep
+    end
 end
 
+# XPA get request writing data to a file descriptor.
+function _getfd(conn::Client, apt::AbstractString, params::AbstractString,
+                mode::AbstractString, fd::Cint, nmax::Int, throwerrors::Bool,
+                users::Union{Nothing,AbstractString})
+    users === nothing || return _merge(_resolve(conn, apt, users, nmax), nmax,
+                                       throwerrors) do addr
+        _getfd(conn, addr, params, mode, fd, 1, false, nothing)
+    end
+    rep = _acquire_reply(nmax)
+    address = pointer(rep.buffers)
+    offset = nmax*sizeof(Ptr{Byte})
+    # A negative number of servers means that a single file descriptor is
+    # used for all servers.
+    local replies::Cint
+    lock(_CLIENT_LOCK)
+    try
+        replies = GC.@preserve rep ccall(
+            (:XPAGetFd, libxpa), Cint,
+            (Ptr{Cvoid}, Cstring, Cstring, Cstring, Ptr{Cint},
+             Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
+            conn, apt, params, mode, Ref(fd),
+            address + offset, address + 2*offset, -nmax)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
+    return _finish!(rep, replies, apt, throwerrors)
+end
+
+# XPA set request reading data from an I/O stream.
+function _setfd(conn::Client, apt::AbstractString, params::AbstractString,
+                mode::AbstractString, io::IO, nmax::Int, throwerrors::Bool,
+                users::Union{Nothing,AbstractString})
+    # The file can only be read once, so it is read in memory if it has to be
+    # sent to several addresses.
+    (io isa IOStream && users === nothing) ||
+        return _set(conn, apt, params, mode, read(io), nmax, throwerrors,
+                    users)
+    rep = _acquire_reply(nmax)
+    address = pointer(rep.buffers)
+    offset = nmax*sizeof(Ptr{Byte})
+    local replies::Cint
+    lock(_CLIENT_LOCK)
+    try
+        replies = GC.@preserve io rep ccall(
+            (:XPASetFd, libxpa), Cint,
+            (Ptr{Cvoid}, Cstring, Cstring, Cstring, Cint,
+             Ptr{Ptr{Byte}}, Ptr{Ptr{Byte}}, Cint),
+            conn, apt, params, mode, _fd(io),
+            address + offset, address + 2*offset, nmax)
+    finally
+        unlock(_CLIENT_LOCK)
+    end
+    return _finish!(rep, replies, apt, throwerrors)
+end
+
+# The file descriptor of an `IOStream` may be an integer or a `RawFD`
+# depending on Julia version.
+_fd(io::IOStream) = Base.cconvert(Cint, fd(io))::Cint
+
 """
     buf = XPA.buffer(data)
 
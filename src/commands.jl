@@ -0,0 +1,260 @@
+#
+# commands.jl --
+#
+# Implement tables of sub-commands for XPA servers.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+"""
+```julia
+XPA.Commands([data,] "verb" => (send=sfunc, recv=rfunc, help="..."), ...;
+             acl=true, compress=true)
+```
+
+yields a table of sub-commands to be served by an XPA server, see
+[`XPA.Server`](@ref).  The first word of the parameter list of an
+[`XPA.get`](@ref) or [`XPA.set`](@ref) request is the name of the command
+(here `"verb"`), the rest of the parameter list is given to the send
+function `sfunc` or to the receive function `rfunc` of this command:
+
+```julia
+sfunc(data, srv::XPA.Server, args::XPA.StringView, buf::XPA.SendBuffer)
+rfunc(data, srv::XPA.Server, args::XPA.StringView, buf::XPA.ReceiveBuffer)
+```
+
+where `data` is the client data common to all commands (`nothing` by
+default) and `args` is a view of the arguments of the command with leading
+spaces removed.  These functions shall return [`XPA.SUCCESS`](@ref) or
+[`XPA.FAILURE`](@ref) as other XPA callbacks, any other result is reported
+to the client as an error.  Any of the `send`, `recv` and
+`help` fields may be omitted: a client request to a command with no
+function of the corresponding kind is rejected.  The command named `""` (if
+any) serves requests with an empty parameter list.
+
+The command is found without allocating memory: each name is indexed by a
+hash of its bytes (verified byte by byte) and the functions are stored in
+tuples so that they are compiled for their actual types.  The cost of
+dispatching a request is thus independent of the number of commands.  The
+parameter list is never copied, so `args` must not be used after the
+function has returned.  Call `String(args)` to keep a copy.
+
+Keywords `acl` and `compress` have the same meaning as for
+[`XPA.SendCallback`](@ref).
+
+Example:
+
+```julia
+cmds = XPA.Commands(
+    "version" => (send = (_, srv, args, buf) -> (XPA.store!(buf, "1.0");
+                                                 XPA.SUCCESS),
+                  help = "get version"),
+    "quit"    => (recv = (_, srv, args, buf) -> (close(srv); XPA.SUCCESS),
+                  help = "terminate server"))
+srv = XPA.Server("TEST", "demo", "demo server", cmds)
+```
+
+"""
+Commands(cmds::Pair{<:AbstractString}...; kwds...) =
+    Commands(nothing, cmds...; kwds...)
+
+function Commands(data::T, cmds::Pair{<:AbstractString}...;
+                  acl::Bool = true, compress::Bool = true) where {T}
+    verbs = Vector{String}(undef, length(cmds))
+    help = Vector{String}(undef, length(cmds))
+    index = Dict{UInt64,Int}()
+    for (i, (verb, def)) in enumerate(cmds)
+        isa(def, NamedTuple) || throw(ArgumentError(
+            "definition of command \"$verb\" must be a named tuple"))
+        for key in keys(def)
+            key ∈ (:send, :recv, :help) || throw(ArgumentError(
+                "invalid field `$key` for command \"$verb\""))
+        end
+        verbs[i] = String(verb)
+        help[i] = String(Base.get(def, :help, ""))
+        h = _fnv1a(verbs[i])
+        haskey(index, h) && throw(ArgumentError(
+            (verbs[index[h]] == verbs[i] ?
+             "duplicate command \"$verb\"" :
+             "hash collision between commands \"$(verbs[index[h]])\" and \"$verb\"")))
+        index[h] = i
+    end
+    send = map(p -> _handler(last(p), :send), cmds)
+    recv = map(p -> _handler(last(p), :recv), cmds)
+    return Commands(data, verbs, help, send, recv, index, Server(C_NULL), acl,
+                    compress)
+end
+
+function _handler(def::NamedTuple, key::Symbol)
+    func = Base.get(def, key, nothing)
+    func === nothing || isa(func, Function) || throw(ArgumentError(
+        "`$key` field of command must be a function"))
+    return func
+end
+
+Base.length(cmds::Commands) = length(cmds.verbs)
+Base.keys(cmds::Commands) = cmds.verbs
+Base.haskey(cmds::Commands, verb::AbstractString) =
+    _lookup(cmds, verb) > 0
+
+function Base.show(io::IO, cmds::Commands)
+    print(io, "XPA.Commands(")
+    join(io, (repr(verb) for verb in cmds.verbs), ", ")
+    print(io, ")")
+end
+
+# Yield the help of the server serving the commands `cmds`.
+function _help(help::AbstractString, cmds::Commands)
+    io = IOBuffer()
+    print(io, help)
+    isempty(help) || print(io, "\n")
+    print(io, "commands:")
+    for i in 1:length(cmds)
+        print(io, "\n  ", cmds.verbs[i])
+        isempty(cmds.help[i]) || print(io, " -- ", cmds.help[i])
+    end
+    return String(take!(io))
+end
+
+# Yield the index of command `verb` or 0 if not found.
+_lookup(cmds::Commands, verb::AbstractString) = _lookup(cmds, String(verb))
+function _lookup(cmds::Commands, verb::Union{String,StringView})
+    i = Base.get(cmds.index, _fnv1a(verb), 0)
+    return (i > 0 && cmds.verbs[i] == verb ? i : 0)
+end
+
+# Split the parameter list at `ptr` in a command name and its arguments.
+function _split_command(ptr::Ptr{Byte})
+    str = StringView(ptr)
+    len = sizeof(str)
+    i = 1
+    while i ≤ len && _isspace(unsafe_load(ptr, i))
+        i += 1
+    end
+    j = i
+    while j ≤ len && !_isspace(unsafe_load(ptr, j))
+        j += 1
+    end
+    k = j
+    while k ≤ len && _isspace(unsafe_load(ptr, k))
+        k += 1
+    end
+    return (StringView(ptr + (i - 1), j - i),
+            StringView(ptr + (k - 1), len + 1 - k))
+end
+
+_isspace(c::Byte) = (c == 0x20)|(0x09 ≤ c ≤ 0x0d)
+
+# Yield a Julia handle for the XPA server `ptr` avoiding to allocate a new
+# one for each request.  The handle does not own the server (it has no
+# finalizer).
+function _server(cmds::Commands, ptr::Ptr{Cvoid})
+    srv = cmds.server
+    if srv.ptr != ptr
+        srv = Server(ptr)
+        cmds.server = srv
+    end
+    return srv
+end
+
+# Call the `i`-th function of the tuple `funcs` (recursion is unrolled by the
+# compiler so that the call is type-stable).
+@inline _call_nth(funcs::Tuple, i::Int, verb::StringView,
+                  data, srv::Server, args::StringView, buf) =
+    (i == 1 ? _call_command(first(funcs), verb, data, srv, args, buf) :
+     _call_nth(Base.tail(funcs), i - 1, verb, data, srv, args, buf))
+_call_nth(::Tuple{}, i::Int, verb::StringView, data, srv::Server,
+          args::StringView, buf) = _no_command(srv, verb)
+
+function _call_command(func::Function, verb::StringView, data, srv::Server,
+                       args::StringView, buf)::Cint
+    status = func(data, srv, args, buf)
+    return (status isa Integer && typemin(Cint) ≤ status ≤ typemax(Cint) ?
+            Cint(status) : _bad_status(srv, verb, status))
+end
+_call_command(::Nothing, verb::StringView, data, srv::Server,
+              args::StringView, buf::SendBuffer) =
+    error(srv, "command \"$verb\" does not support XPA.get requests")
+_call_command(::Nothing, verb::StringView, data, srv::Server,
+              args::StringView, buf::ReceiveBuffer) =
+    error(srv, "command \"$verb\" does not support XPA.set requests")
+
+@noinline _bad_status(srv::Server, verb::StringView, status) =
+    error(srv, "command \"$verb\" returned $(repr(status)) instead of a status")
+
+@noinline _no_command(srv::Server, verb::StringView) =
+    error(srv, (isempty(verb) ? "missing command" :
+                "unknown command \"$verb\""))
+
+# The following callbacks are compiled for each concrete type of command
+# table, the client data is the address of the table.
+function _send(cmds::Commands, handle::Ptr{Cvoid}, params::Ptr{Byte},
+               bufptr::Ptr{Ptr{Byte}}, lenptr::Ptr{Csize_t})::Cint
+    srv = _server(cmds, handle)
+    (get_send_mode(srv) & _MINIMAL_SEND_MODE) == _MINIMAL_SEND_MODE ||
+        return error(srv, "send mode must have option `freebuf=true`")
+    _set_free(handle, C_NULL, C_NULL)
+    opts, params = _request_options(params)
+    verb, args = _split_command(params)
+    buf = SendBuffer(bufptr, lenptr, handle)
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    status = _call_nth(cmds.send, _lookup(cmds, verb), verb, cmds.data, srv,
+                       args, buf)
+    dt = (_instrumented() ? time_ns() - t0 : UInt64(0))
+    status == SUCCESS && opts != 0 && _encode!(buf, opts, cmds.compress)
+    _instrumented() && _record_server!(srv, params, dt, status, 0,
+                                       unsafe_load(lenptr))
+    return status
+end
+
+function _recv(cmds::Commands, handle::Ptr{Cvoid}, params::Ptr{Byte},
+               buf::Ptr{Byte}, len::Csize_t)::Cint
+    srv = _server(cmds, handle)
+    (get_recv_mode(srv) & _MINIMAL_RECEIVE_MODE) == _MINIMAL_RECEIVE_MODE ||
+        return error(srv, "receive mode must have options `buf=true`, `fillbuf=true` and `freebuf=true`")
+    opts, params = _request_options(params)
+    if (opts & _OPTION_LZ4) != 0
+        buf, len = _decompress!(srv, buf, len)
+    end
+    verb, args = _split_command(params)
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    status = _call_nth(cmds.recv, _lookup(cmds, verb), verb, cmds.data, srv,
+                       args, ReceiveBuffer(buf, len))
+    _instrumented() && _record_server!(srv, params, time_ns() - t0, status,
+                                       len, 0)
+    return status
+end
+
+_send_callback(::C) where {C<:Commands} =
+    @cfunction(_send, Cint, (Ref{C},            # client_data
+                             Ptr{Cvoid},        # call_data
+                             Ptr{Byte},         # paramlist
+                             Ptr{Ptr{Byte}},    # buf
+                             Ptr{Csize_t}))     # len
+
+_recv_callback(::C) where {C<:Commands} =
+    @cfunction(_recv, Cint, (Ref{C},            # client_data
+                             Ptr{Cvoid},        # call_data
+                             Ptr{Byte},         # paramlist
+                             Ptr{Byte},         # buf
+                             Csize_t))          # len
+
+_hasany(funcs::Tuple) = any(f -> f !== nothing, funcs)
+
+function Server(class::AbstractString, name::AbstractString,
+                help::AbstractString, cmds::Commands)
+    ctx = pointer_from_objref(cmds)
+    hassend, hasrecv = _hasany(cmds.send), _hasany(cmds.recv)
+    server = Server(class, name, _help(help, cmds),
+                    (hassend ? _send_callback(cmds) : C_NULL),
+                    (hassend ? ctx : C_NULL),
+                    (hassend ? "acl=$(cmds.acl),freebuf=true" : ""),
+                    (hasrecv ? _recv_callback(cmds) : C_NULL),
+                    (hasrecv ? ctx : C_NULL),
+                    (hasrecv ? "acl=$(cmds.acl),buf=true,fillbuf=true,freebuf=true" : ""))
+    _root!(server.ptr, (cmds, nothing))
+    return server
+end
@@ -0,0 +1,415 @@
+#
+# compression.jl --
+#
+# Implement the compression of the data transferred between XPA clients and
+# servers of the XPA package.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# Compressed data are stored in a frame made of a header followed by the
+# compressed chunks.  All integers are stored in little endian byte order.
+#
+#     bytes 1-4     magic "XPZ1"
+#     bytes 5-12    number of bytes of the uncompressed data (UInt64)
+#     bytes 13-16   number of bytes of an uncompressed chunk (UInt32)
+#     bytes 17-20   number of chunks, say `n` (UInt32)
+#     next 4n bytes size of each compressed chunk (UInt32), if the most
+#                   significant bit is set, the chunk is stored uncompressed
+#
+# Each chunk is compressed independently in the LZ4 block format, so the
+# chunks of large data can be processed in parallel.
+const _XPZ_MAGIC = (0x58, 0x50, 0x5a, 0x31) # "XPZ1"
+const _XPZ_HEADER = 20
+const _XPZ_STORED = 0x80000000
+const _XPZ_CHUNK = 1 << 20  # size of uncompressed chunks
+const _XPZ_MINSIZE = 1024   # smaller data are not compressed
+
+# Options of a request (see `_request_options`).
+const _OPTIONS_PREFIX = "@xpa.jl:"
+const _OPTION_LZ4 = UInt(1)
+const _OPTION_SHM = UInt(2)
+
+function _options_prefix(opts::UInt)
+    lz4 = (opts & _OPTION_LZ4) != 0
+    shm = (opts & _OPTION_SHM) != 0
+    return (lz4 & shm ? _OPTIONS_PREFIX*"lz4,shm " :
+            lz4 ? _OPTIONS_PREFIX*"lz4 " :
+            shm ? _OPTIONS_PREFIX*"shm " : "")
+end
+
+"""
+```julia
+_request_options(ptr) -> (opts, ptr)
+```
+
+yields the options negotiated by a client of the XPA package at the
+beginning of the parameter list at address `ptr` (a null terminated string)
+and the address of the parameters following these options.  The options are
+given by a prefix of the form `"@xpa.jl:opt1,opt2,... "`, unknown options
+are ignored.
+
+"""
+function _request_options(ptr::Ptr{Byte})
+    opts = UInt(0)
+    ptr == NULL && return (opts, ptr)
+    n = sizeof(_OPTIONS_PREFIX)
+    for i in 1:n
+        unsafe_load(ptr, i) == codeunit(_OPTIONS_PREFIX, i) ||
+            return (opts, ptr)
+    end
+    i = j = n + 1
+    while true
+        j = i
+        c = unsafe_load(ptr, j)
+        while c != 0x00 && c != 0x20 && c != 0x2c
+            j += 1
+            c = unsafe_load(ptr, j)
+        end
+        if _is_option(ptr, i, j, "lz4")
+            opts |= _OPTION_LZ4
+        elseif _is_option(ptr, i, j, "shm")
+            opts |= _OPTION_SHM
+        end
+        c == 0x2c || break
+        i = j + 1
+    end
+    while unsafe_load(ptr, j) == 0x20
+        j += 1
+    end
+    return (opts, ptr + (j - 1))
+end
+
+# Yield whether bytes `i:j-1` at `ptr` are the name of option `name`.
+function _is_option(ptr::Ptr{Byte}, i::Int, j::Int, name::String)
+    j - i == sizeof(name) || return false
+    for k in 1:sizeof(name)
+        unsafe_load(ptr, i + k - 1) == codeunit(name, k) || return false
+    end
+    return true
+end
+
+"""
+```julia
+_compress(ptr, len) -> (zptr, zlen)
+```
+
+compresses the `len` bytes at address `ptr` and yields the address and size
+of a dynamically allocated buffer with the compressed frame.  If the data
+is too small or cannot be compressed, `(NULL,0)` is returned.  Each chunk is
+compressed by a different thread if Julia has several threads.
+
+"""
+function _compress(src::Ptr{Byte}, len::Int)
+    (src == NULL || len < _XPZ_MINSIZE) && return (NULL, 0)
+    n = div(len + _XPZ_CHUNK - 1, _XPZ_CHUNK)
+    bound = _lz4_bound(_XPZ_CHUNK)
+    tmp = _malloc(n*bound)
+    sizes = Vector{UInt32}(undef, n)
+    try
+        _foreach_chunk(n) do j
+            local inp = src + (j - 1)*_XPZ_CHUNK
+            local out = tmp + (j - 1)*bound
+            local clen = min(_XPZ_CHUNK, len - (j - 1)*_XPZ_CHUNK)
+            local zlen = _lz4_compress!(out, inp, clen)
+            if zlen ≥ clen
+                _memcpy!(out, inp, clen)
+                sizes[j] = (clen % UInt32) | _XPZ_STORED
+            else
+                sizes[j] = zlen % UInt32
+            end
+        end
+        total = _XPZ_HEADER + 4n
+        for j in 1:n
+            total += sizes[j] & ~_XPZ_STORED
+        end
+        total < len || return (NULL, 0)
+        dst = _malloc(total)
+        for i in 1:4
+            unsafe_store!(dst, _XPZ_MAGIC[i], i)
+        end
+        _store_le(dst + 4, UInt64(len))
+        _store_le(dst + 12, UInt32(_XPZ_CHUNK))
+        _store_le(dst + 16, UInt32(n))
+        off = _XPZ_HEADER + 4n
+        for j in 1:n
+            _store_le(dst + _XPZ_HEADER + 4(j - 1), sizes[j])
+            zlen = Int(sizes[j] & ~_XPZ_STORED)
+            _memcpy!(dst + off, tmp + (j - 1)*bound, zlen)
+            off += zlen
+        end
+        return (dst, total)
+    finally
+        _free(tmp)
+    end
+end
+
+"""
+```julia
+_is_compressed(ptr, len)
+```
+
+yields whether the `len` bytes at address `ptr` are a valid compressed frame.
+
+"""
+function _is_compressed(ptr::Ptr{Byte}, len::Integer)
+    (ptr != NULL && len ≥ _XPZ_HEADER) || return false
+    for i in 1:4
+        unsafe_load(ptr, i) == _XPZ_MAGIC[i] || return false
+    end
+    nbytes = _load_le(UInt64, ptr + 4)
+    chunk = Int(_load_le(UInt32, ptr + 12))
+    n = Int(_load_le(UInt32, ptr + 16))
+    (chunk > 0 && nbytes ≤ typemax(Int) &&
+     n == div(nbytes + chunk - 1, chunk)) || return false
+    total = _XPZ_HEADER + 4n
+    len ≥ total || return false
+    for j in 1:n
+        total += _load_le(UInt32, ptr + _XPZ_HEADER + 4(j - 1)) & ~_XPZ_STORED
+    end
+    return total == len
+end
+
+"""
+```julia
+_decompress(ptr, len) -> (dptr, dlen)
+```
+
+decompresses the compressed frame of `len` bytes at address `ptr` and yields
+the address and size of a dynamically allocated buffer with the original
+data.  The frame must have been checked by `_is_compressed`.
+
+"""
+function _decompress(src::Ptr{Byte}, len::Integer)
+    nbytes = Int(_load_le(UInt64, src + 4))
+    chunk = Int(_load_le(UInt32, src + 12))
+    n = Int(_load_le(UInt32, src + 16))
+    offsets = Vector{Int}(undef, n)
+    off = _XPZ_HEADER + 4n
+    for j in 1:n
+        offsets[j] = off
+        off += _load_le(UInt32, src + _XPZ_HEADER + 4(j - 1)) & ~_XPZ_STORED
+    end
+    dst = _malloc(max(nbytes, 1))
+    try
+        _foreach_chunk(n) do j
+            local zsize = _load_le(UInt32, src + _XPZ_HEADER + 4(j - 1))
+            local zlen = Int(zsize & ~_XPZ_STORED)
+            local clen = min(chunk, nbytes - (j - 1)*chunk)
+            local out = dst + (j - 1)*chunk
+            if (zsize & _XPZ_STORED) != 0
+                zlen == clen || error("corrupted compressed data")
+                _memcpy!(out, src + offsets[j], clen)
+            else
+                _lz4_decompress!(out, clen, src + offsets[j], zlen)
+            end
+        end
+    catch
+        _free(dst)
+        rethrow()
+    end
+    return (dst, nbytes)
+end
+
+# Apply `f(j)` for `j ∈ 1:n`, in parallel if possible.  The caller takes its
+# share of the work and then waits for the helper tasks, which may run on its
+# own thread and which exit if all work is done when they start.  While a
+# server callback waits, other tasks may run but cannot process XPA requests
+# as `_XPA_LOCK` is held by the serving task.
+function _foreach_chunk(f::Function, n::Int)
+    if n ≤ 1 || Threads.nthreads() ≤ 1
+        for j in 1:n
+            f(j)
+        end
+        return nothing
+    end
+    next = Threads.Atomic{Int}(1)
+    failure = Ref{Any}(nothing)
+    work = () -> begin
+        while (j = Threads.atomic_add!(next, 1)) ≤ n
+            try
+                f(j)
+            catch err
+                failure[] = err
+            end
+        end
+    end
+    tasks = [Threads.@spawn(work()) for k in 2:min(n, Threads.nthreads())]
+    work()
+    foreach(wait, tasks)
+    failure[] === nothing || throw(failure[])
+    return nothing
+end
+
+_store_le(ptr::Ptr{Byte}, val::Union{UInt32,UInt64}) =
+    unsafe_store!(Ptr{typeof(val)}(ptr), htol(val))
+
+_load_le(::Type{T}, ptr::Ptr{Byte}) where {T<:Union{UInt32,UInt64}} =
+    ltoh(unsafe_load(Ptr{T}(ptr)))
+
+#------------------------------------------------------------------------------
+# LZ4 BLOCK FORMAT
+#
+# A block is a sequence of (literals, match) pairs.  Each sequence starts with
+# a token whose 4 most significant bits are the number of literals and 4 least
+# significant bits are the length of the match minus 4; if 15, more bytes
+# (255 meaning to continue) follow to encode the length.  The literals follow
+# the token and the match is encoded by a 2-byte offset (little endian).  The
+# last sequence has only literals: the last 5 bytes are always literals and
+# the last match starts at least 12 bytes before the end of the block.
+
+const _LZ4_HASHLOG = 12
+const _LZ4_MINMATCH = 4
+const _LZ4_MFLIMIT = 12
+const _LZ4_LASTLITERALS = 5
+const _LZ4_MAXOFFSET = 65535
+
+_lz4_bound(len::Int) = len + div(len, 255) + 16
+
+@inline _lz4_read32(ptr::Ptr{Byte}, i::Int) =
+    unsafe_load(Ptr{UInt32}(ptr + (i - 1)))
+
+@inline _lz4_hash(seq::UInt32) =
+    Int((seq*0x9e3779b1) >> (32 - _LZ4_HASHLOG)) + 1
+
+# Write the length `len` in excess of 15 at `dst[op]`, return next index.
+@inline function _lz4_write_length(dst::Ptr{Byte}, op::Int, len::Int)
+    while len ≥ 255
+        unsafe_store!(dst, 0xff, op)
+        op += 1
+        len -= 255
+    end
+    unsafe_store!(dst, len%UInt8, op)
+    return op + 1
+end
+
+# Compress the `len` bytes at `src` into `dst` which must have at least
+# `_lz4_bound(len)` bytes, return the size of the compressed block.
+function _lz4_compress!(dst::Ptr{Byte}, src::Ptr{Byte}, len::Int)
+    table = zeros(Int, 1 << _LZ4_HASHLOG)
+    op = 1     # next index in `dst`
+    anchor = 1 # index of first pending literal in `src`
+    i = 1
+    misses = 0
+    mflimit = len - _LZ4_MFLIMIT + 1
+    matchlimit = len - _LZ4_LASTLITERALS
+    @inbounds while i ≤ mflimit
+        seq = _lz4_read32(src, i)
+        h = _lz4_hash(seq)
+        ref = table[h]
+        table[h] = i
+        if ref > 0 && i - ref ≤ _LZ4_MAXOFFSET && _lz4_read32(src, ref) == seq
+            # Extend the match forward.
+            mlen = _LZ4_MINMATCH
+            while i + mlen ≤ matchlimit &&
+                unsafe_load(src, ref + mlen) == unsafe_load(src, i + mlen)
+                mlen += 1
+            end
+            # Emit the sequence.
+            lit = i - anchor
+            tok = op
+            op += 1
+            if lit ≥ 15
+                token = 0xf0
+                op = _lz4_write_length(dst, op, lit - 15)
+            else
+                token = (lit%UInt8) << 4
+            end
+            _memcpy!(dst + (op - 1), src + (anchor - 1), lit)
+            op += lit
+            off = i - ref
+            unsafe_store!(dst, (off & 0xff)%UInt8, op)
+            unsafe_store!(dst, (off >> 8)%UInt8, op + 1)
+            op += 2
+            m = mlen - _LZ4_MINMATCH
+            if m ≥ 15
+                token |= 0x0f
+                op = _lz4_write_length(dst, op, m - 15)
+            else
+                token |= m%UInt8
+            end
+            unsafe_store!(dst, token, tok)
+            i += mlen
+            anchor = i
+            misses = 0
+        else
+            # Skip faster in incompressible data.
+            misses += 1
+            i += 1 + (misses >> 6)
+        end
+    end
+    # Emit the last literals.
+    lit = len - anchor + 1
+    if lit ≥ 15
+        unsafe_store!(dst, 0xf0, op)
+        op = _lz4_write_length(dst, op + 1, lit - 15)
+    else
+        unsafe_store!(dst, (lit%UInt8) << 4, op)
+        op += 1
+    end
+    _memcpy!(dst + (op - 1), src + (anchor - 1), lit)
+    return op + lit - 1
+end
+
+# Decompress the LZ4 block of `len` bytes at `src` into the `dstlen` bytes at
+# `dst`.  All accesses are checked, so corrupted data throw an error.
+function _lz4_decompress!(dst::Ptr{Byte}, dstlen::Int,
+                          src::Ptr{Byte}, len::Int)
+    ip = 1
+    op = 1
+    while true
+        ip ≤ len || @goto corrupted
+        token = unsafe_load(src, ip)
+        ip += 1
+        # Copy literals.
+        lit = Int(token >> 4)
+        if lit == 15
+            while true
+                ip ≤ len || @goto corrupted
+                b = unsafe_load(src, ip)
+                ip += 1
+                lit += b
+                b == 0xff || break
+            end
+        end
+        (ip + lit - 1 ≤ len && op + lit - 1 ≤ dstlen) || @goto corrupted
+        _memcpy!(dst + (op - 1), src + (ip - 1), lit)
+        ip += lit
+        op += lit
+        ip > len && break # last sequence
+        # Copy match.
+        ip + 1 ≤ len || @goto corrupted
+        off = Int(unsafe_load(src, ip)) | (Int(unsafe_load(src, ip + 1)) << 8)
+        ip += 2
+        (0 < off < op) || @goto corrupted
+        mlen = Int(token & 0x0f)
+        if mlen == 15
+            while true
+                ip ≤ len || @goto corrupted
+                b = unsafe_load(src, ip)
+                ip += 1
+                mlen += b
+                b == 0xff || break
+            end
+        end
+        mlen += _LZ4_MINMATCH
+        op + mlen - 1 ≤ dstlen || @goto corrupted
+        ref = op - off
+        if off ≥ mlen
+            _memcpy!(dst + (op - 1), dst + (ref - 1), mlen)
+        else
+            # Overlapping copy (repeated pattern).
+            for k in 0:mlen-1
+                unsafe_store!(dst, unsafe_load(dst, ref + k), op + k)
+            end
+        end
+        op += mlen
+    end
+    op - 1 == dstlen || @goto corrupted
+    return nothing
+    @label corrupted
+    error("corrupted compressed data")
+end
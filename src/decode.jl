@@ -0,0 +1,188 @@
+#
+# decode.jl --
+#
+# Decode numbers written in textual form in the answers of XPA servers.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# Types of the values that can be decoded from text.
+const _Decodable = Union{Signed,Unsigned,AbstractFloat}
+
+"""
+```julia
+XPA.get(T, [conn,] apt, args...; kwds...) -> val
+XPA.get(NTuple{N,T}, [conn,] apt, args...; kwds...) -> tup
+XPA.get(Vector{T}, [conn,] apt, args...; text=true, kwds...) -> vec
+```
+
+retrieve the answer of an [`XPA.get`](@ref) request as numbers written in
+textual form, for instance:
+
+```julia
+XPA.get(Float64, "DS9:*", "zoom")            # -> 2.0
+XPA.get(NTuple{2,Int}, "DS9:*", "crosshair") # -> (512, 512)
+XPA.get(Vector{Int}, "DS9:*", "frame all"; text=true)
+```
+
+Here `T` is a type of integer (`Bool` excluded) or of floating-point value.
+The values are separated by spaces (including tabs and newlines) and are
+parsed directly in the buffer of the answer, which is freed as soon as the
+values have been decoded (no `String` is built).  The answer must have
+exactly one value for the first form, exactly `N` values for the second one,
+any number of values for the third one.  An exception is thrown otherwise
+or if a value cannot be parsed (or is too large) for type `T`.
+
+As for `XPA.get(String, ...)`, a single answer and no errors are expected.
+The same decoding is done by `XPA.get_data(T, rep, i=1)`,
+`XPA.get_data(NTuple{N,T}, rep, i=1)` and `XPA.get_data(Vector{T}, rep,
+i=1; text=true)` for the `i`-th answer in `rep`.
+
+"""
+function get(::Type{T}, args...; kwds...) :: T where {T<:_Decodable}
+    _get1(args...; kwds...) do rep
+        get_data(T, rep)
+    end
+end
+
+function get(::Type{NTuple{N,T}},
+             args...; kwds...) :: NTuple{N,T} where {N,T<:_Decodable}
+    _get1(args...; kwds...) do rep
+        get_data(NTuple{N,T}, rep)
+    end
+end
+
+function get_data(::Type{T}, rep::Reply,
+                  i::Integer = 1) :: T where {T<:_Decodable}
+    ptr, len = _get_buf(rep, Int(i), true)
+    first = _skip_spaces(ptr, len, 1)
+    last = _token_end(ptr, len, first)
+    first ≤ len || _decode_count_error(T, 1, 0)
+    _skip_spaces(ptr, len, last + 1) > len || _decode_count_error(T, 1, 2)
+    return _decode(T, ptr, len, first, last)
+end
+
+function get_data(::Type{NTuple{N,T}}, rep::Reply,
+                  i::Integer = 1) :: NTuple{N,T} where {N,T<:_Decodable}
+    ptr, len = _get_buf(rep, Int(i), true)
+    pos = Ref(1)
+    tup = ntuple(k -> _decode_next(T, ptr, len, pos, N), Val(N))
+    _skip_spaces(ptr, len, pos[]) > len || _decode_count_error(T, N, N + 1)
+    return tup
+end
+
+# Decode into a vector all the values of the `i`-th answer in `rep`.
+function _decode_vector(::Type{T}, rep::Reply,
+                        i::Integer) :: Vector{T} where {T<:_Decodable}
+    ptr, len = _get_buf(rep, Int(i), true)
+    cnt = 0
+    k = _skip_spaces(ptr, len, 1)
+    while k ≤ len
+        cnt += 1
+        k = _skip_spaces(ptr, len, _token_end(ptr, len, k) + 1)
+    end
+    vec = Vector{T}(undef, cnt)
+    k = _skip_spaces(ptr, len, 1)
+    for j in 1:cnt
+        last = _token_end(ptr, len, k)
+        vec[j] = _decode(T, ptr, len, k, last)
+        k = _skip_spaces(ptr, len, last + 1)
+    end
+    return vec
+end
+
+_decode_vector(::Type{T}, rep::Reply, i::Integer) where {T} =
+    error("cannot decode values of type $T from text")
+
+# Decode the next of `n` values starting at index `pos[]`.
+function _decode_next(::Type{T}, ptr::Ptr{Byte}, len::Int,
+                      pos::Base.RefValue{Int}, n::Int) where {T}
+    first = _skip_spaces(ptr, len, pos[])
+    first ≤ len || _decode_count_error(T, n, n - 1)
+    last = _token_end(ptr, len, first)
+    pos[] = last + 1
+    return _decode(T, ptr, len, first, last)
+end
+
+# Yield the index of the first byte which is not a space at or after index
+# `k`, `len + 1` if none.
+function _skip_spaces(ptr::Ptr{Byte}, len::Int, k::Int)
+    while k ≤ len && _isspace(unsafe_load(ptr, k))
+        k += 1
+    end
+    return k
+end
+
+# Yield the index of the last byte of the token starting at index `k`.
+function _token_end(ptr::Ptr{Byte}, len::Int, k::Int)
+    while k ≤ len && !_isspace(unsafe_load(ptr, k))
+        k += 1
+    end
+    return k - 1
+end
+
+# Parse the bytes `first:last` at `ptr` (of length `len`) as a value of
+# type `T`.
+function _decode(::Type{T}, ptr::Ptr{Byte}, len::Int, first::Int,
+                 last::Int) :: T where {T<:Union{Signed,Unsigned}}
+    k = first
+    c = unsafe_load(ptr, k)
+    neg = (c == UInt8('-'))
+    (neg || c == UInt8('+')) && (k += 1)
+    (k ≤ last && !(neg && T <: Unsigned)) ||
+        _decode_error(T, ptr, first, last)
+    val = zero(T)
+    while k ≤ last
+        d = unsafe_load(ptr, k) - UInt8('0')
+        d ≤ 9 || _decode_error(T, ptr, first, last)
+        val, o1 = Base.mul_with_overflow(val, T(10))
+        val, o2 = (neg ? Base.sub_with_overflow(val, T(d)) :
+                   Base.add_with_overflow(val, T(d)))
+        (o1|o2) && _decode_error(T, ptr, first, last)
+        k += 1
+    end
+    return val
+end
+
+function _decode(::Type{T}, ptr::Ptr{Byte}, len::Int, first::Int,
+                 last::Int) :: T where {T<:AbstractFloat}
+    return T(_decode(Float64, ptr, len, first, last))
+end
+
+for (T, func) in ((Float64, :jl_try_substrtod),
+                  (Float32, :jl_try_substrtof))
+    @eval function _decode(::Type{$T}, ptr::Ptr{Byte}, len::Int, first::Int,
+                           last::Int)
+        # The C function checks the byte following the token which must
+        # exist, so a token at the end of the buffer is copied.
+        if last < len
+            ok, val = ccall($(QuoteNode(func)), Tuple{Bool,$T},
+                            (Ptr{Byte}, Csize_t, Csize_t),
+                            ptr, first - 1, last - first + 1)
+        else
+            buf = Vector{Byte}(undef, last - first + 2)
+            GC.@preserve buf begin
+                _memcpy!(pointer(buf), ptr + (first - 1), last - first + 1)
+                buf[end] = 0x00
+                ok, val = ccall($(QuoteNode(func)), Tuple{Bool,$T},
+                                (Ptr{Byte}, Csize_t, Csize_t),
+                                pointer(buf), 0, last - first + 1)
+            end
+        end
+        ok || _decode_error($T, ptr, first, last)
+        return val
+    end
+end
+
+@noinline _decode_error(::Type{T}, ptr::Ptr{Byte}, first::Int,
+                        last::Int) where {T} =
+    error("cannot parse \"", unsafe_string(ptr + (first - 1),
+                                           last - first + 1),
+          "\" as a value of type ", T)
+
+@noinline _decode_count_error(::Type{T}, n::Int, cnt::Int) where {T} =
+    error(cnt < n ? "too few" : "too many", " values in answer (expecting ",
+          n, " value", (n > 1 ? "s" : ""), " of type ", T, ")")
@@ -0,0 +1,271 @@
+#
+# framing.jl --
+#
+# Implement the transfer of self-describing arrays between XPA servers and
+# clients.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# A framed array is a header followed by the array elements in column-major
+# order.  The header is made of 8 bytes:
+#
+#     bytes 1-4   magic "XPAA"
+#     byte  5     byte order of the sender, 'L' (little) or 'B' (big endian)
+#     byte  6     element type code (index in `_FRAME_TYPES`)
+#     byte  7     number of dimensions N
+#     byte  8     reserved, must be zero
+#
+# followed by the N dimensions of the array stored as 64-bit integers in the
+# byte order of the sender.  The size of the header is thus a multiple of 8
+# bytes which preserves the alignment of the elements.  Non-contiguous arrays
+# (e.g. views) are packed by the sender, so the elements are always
+# contiguous.
+const _FRAME_MAGIC = (0x58, 0x50, 0x41, 0x41) # "XPAA"
+const _FRAME_LITTLE_ENDIAN = UInt8('L')
+const _FRAME_BIG_ENDIAN = UInt8('B')
+const _FRAME_NATIVE_ENDIAN = (ENDIAN_BOM == 0x04030201 ?
+                              _FRAME_LITTLE_ENDIAN : _FRAME_BIG_ENDIAN)
+const _FRAME_TYPES = (Bool, Int8, UInt8, Int16, UInt16, Int32, UInt32,
+                      Int64, UInt64, Float32, Float64,
+                      Complex{Float32}, Complex{Float64})
+
+function _frame_code(::Type{T}) where {T}
+    for i in 1:length(_FRAME_TYPES)
+        _FRAME_TYPES[i] === T && return UInt8(i)
+    end
+    throw(ArgumentError("arrays of type $T cannot be framed"))
+end
+
+# Decoded header of a framed array.
+struct _FrameHeader
+    eltype::DataType
+    dims::Vector{Int}
+    swap::Bool    # whether bytes must be swapped
+    offset::Int   # offset of first element (in bytes)
+    nbytes::Int   # size of the elements (in bytes)
+end
+
+# Store a framed copy of array `arr` in send buffer `buf`.
+function _store_framed!(buf::SendBuffer, arr::AbstractArray{T,N}) where {T,N}
+    code = _frame_code(T)
+    N ≤ typemax(UInt8) || throw(ArgumentError("too many dimensions"))
+    off = 8 + 8*N
+    len = off + sizeof(T)*length(arr)
+    _discard!(buf)
+    ptr = _malloc(len)
+    for i in 1:4
+        unsafe_store!(ptr, _FRAME_MAGIC[i], i)
+    end
+    unsafe_store!(ptr, _FRAME_NATIVE_ENDIAN, 5)
+    unsafe_store!(ptr, code, 6)
+    unsafe_store!(ptr, N%UInt8, 7)
+    unsafe_store!(ptr, 0x00, 8)
+    for d in 1:N
+        unsafe_store!(Ptr{Int64}(ptr + 8*d), size(arr, d))
+    end
+    if isa(arr, DenseArray)
+        GC.@preserve arr _memcpy!(ptr + off, pointer(arr), sizeof(T)*length(arr))
+    else
+        dst = Ptr{T}(ptr + off)
+        k = 0
+        @inbounds for val in arr
+            unsafe_store!(dst, val, k += 1)
+        end
+    end
+    unsafe_store!(buf.bufptr, ptr)
+    unsafe_store!(buf.lenptr, len)
+    return nothing
+end
+
+# Decode the header of the framed array stored in the `len` bytes at `ptr`.
+function _frame_header(ptr::Ptr{Byte}, len::Integer)
+    (ptr != NULL && len ≥ 8 &&
+     unsafe_load(ptr, 1) == _FRAME_MAGIC[1] &&
+     unsafe_load(ptr, 2) == _FRAME_MAGIC[2] &&
+     unsafe_load(ptr, 3) == _FRAME_MAGIC[3] &&
+     unsafe_load(ptr, 4) == _FRAME_MAGIC[4]) ||
+         error("data is not a framed array")
+    order = unsafe_load(ptr, 5)
+    (order == _FRAME_LITTLE_ENDIAN || order == _FRAME_BIG_ENDIAN) ||
+        error("invalid byte order in framed array")
+    code = unsafe_load(ptr, 6)
+    1 ≤ code ≤ length(_FRAME_TYPES) ||
+        error("unknown element type in framed array")
+    N = Int(unsafe_load(ptr, 7))
+    unsafe_load(ptr, 8) == 0x00 ||
+        error("unsupported flags in framed array header")
+    off = 8 + 8*N
+    len ≥ off || error("truncated framed array header")
+    swap = (order != _FRAME_NATIVE_ENDIAN)
+    dims = Vector{Int}(undef, N)
+    for d in 1:N
+        dims[d] = _load_int64(ptr + 8*d, swap)
+        dims[d] ≥ 0 || error("invalid dimension in framed array")
+    end
+    T = _FRAME_TYPES[code]
+    nbytes = _frame_nbytes(T, dims)
+    nbytes ≤ len - off || error("truncated framed array")
+    return _FrameHeader(T, dims, swap, off, nbytes)
+end
+
+# Yield the number of bytes of the elements of a framed array, the
+# dimensions are given by the sender and their product may overflow.
+function _frame_nbytes(::Type{T}, dims::Vector{Int}) where {T}
+    nbytes = sizeof(T)
+    try
+        for dim in dims
+            nbytes = Base.checked_mul(nbytes, dim)
+        end
+    catch err
+        isa(err, OverflowError) || rethrow()
+        error("too many elements in framed array")
+    end
+    return nbytes
+end
+
+function _load_int64(ptr::Ptr{Byte}, swap::Bool)
+    val = unsafe_load(Ptr{Int64}(ptr))
+    return Int(swap ? bswap(val) : val)
+end
+
+# Extract the framed array of the `i`-th answer in `rep`.
+function _get_framed(rep::Reply, i::Int, preserve::Bool)
+    ptr, len = _get_buf(rep, i, true)
+    hdr = _frame_header(ptr, len)
+    return _get_framed(Array{hdr.eltype,length(hdr.dims)}, hdr, rep, i,
+                       preserve)
+end
+
+function _get_framed(::Type{Array{T}}, rep::Reply, i::Int,
+                     preserve::Bool) where {T}
+    ptr, len = _get_buf(rep, i, true)
+    hdr = _frame_header(ptr, len)
+    hdr.eltype === T || error(
+        "framed array has elements of type $(hdr.eltype), not $T")
+    return _get_framed(Array{T,length(hdr.dims)}, hdr, rep, i, preserve)
+end
+
+function _get_framed(::Type{Array{T,N}}, hdr::_FrameHeader, rep::Reply,
+                     i::Int, preserve::Bool) :: Array{T,N} where {T,N}
+    dims = ntuple(d -> hdr.dims[d], Val(N))
+    ptr, len = _get_buf(rep, i, true)
+    src = ptr + hdr.offset
+    nbytes = hdr.nbytes
+    if preserve || nbytes == 0
+        arr = _memcpy!(Array{T,N}(undef, dims), src, nbytes)
+    elseif _mapping(rep, i) !== nothing
+        # Wrap the memory mapped elements (the size of the header preserves
+        # their alignment).
+        arr = _wrap_mapping(Array{T,N}, _take_mapping!(rep, i), dims,
+                            hdr.offset)
+    else
+        # Take ownership of the buffer and move the elements at its
+        # beginning to avoid allocating another array.
+        ptr, len = _get_buf(rep, i, false)
+        ccall(:memmove, Ptr{Cvoid}, (Ptr{Cvoid}, Ptr{Cvoid}, Csize_t),
+              ptr, src, nbytes)
+        arr = unsafe_wrap(Array, Ptr{T}(ptr), dims, own=true)
+    end
+    hdr.swap && bswap!(arr)
+    return arr
+end
+
+# Copy the framed array stored in the `len` bytes at `ptr` into `dst`.
+function _copy_framed!(dst::DenseArray{T,N}, ptr::Ptr{Byte},
+                       len::Integer) where {T,N}
+    hdr = _frame_header(ptr, len)
+    hdr.eltype === T || error(
+        "framed array has elements of type $(hdr.eltype), not $T")
+    (length(hdr.dims) == N && all(d -> hdr.dims[d] == size(dst, d), 1:N)) ||
+        error("framed array has dimensions $(Tuple(hdr.dims)), not $(size(dst))")
+    hdr.nbytes > 0 && _memcpy!(dst, ptr + hdr.offset, hdr.nbytes)
+    hdr.swap && bswap!(dst)
+    return dst
+end
+
+"""
+```julia
+XPA.bswap!(arr) -> arr
+```
+
+reverses in-place the order of the bytes of the elements of the dense array
+`arr` whose elements must be bits types (complex numbers have their real and
+imaginary parts swapped separately).  The loop is written so as to be
+vectorized by the compiler.
+
+"""
+bswap!(arr::DenseArray{T}) where {T} =
+    (GC.@preserve arr _bswap!(_swap_unit(T), pointer(arr), sizeof(arr)); arr)
+
+function _bswap!(::Type{U}, ptr::Ptr, nbytes::Int) where {U<:Unsigned}
+    p = Ptr{U}(ptr)
+    @inbounds @simd ivdep for i in 1:div(nbytes, sizeof(U))
+        unsafe_store!(p, bswap(unsafe_load(p, i)), i)
+    end
+    return nothing
+end
+
+_bswap!(::Type{UInt8}, ptr::Ptr, nbytes::Int) = nothing
+
+_swap_unit(::Type{Complex{T}}) where {T} = _swap_unit(T)
+function _swap_unit(::Type{T}) where {T}
+    isbitstype(T) || throw(ArgumentError("invalid element type $T"))
+    n = sizeof(T)
+    return (n == 1 ? UInt8 : n == 2 ? UInt16 : n == 4 ? UInt32 :
+            n == 8 ? UInt64 : n == 16 ? UInt128 :
+            throw(ArgumentError("cannot swap bytes of type $T")))
+end
+
+"""
+```julia
+XPA.get(Array, [conn,] apt, args...; kwds...) -> arr
+XPA.get(Array{T}, [conn,] apt, args...; kwds...) -> arr
+```
+
+retrieve a framed array sent by an XPA server with
+`XPA.store!(buf, arr; framed=true)`, see [`XPA.store!`](@ref).  Element type
+and dimensions of the array are given by the server and the bytes of the
+elements are swapped only if the byte orders of the server and of the client
+are different.  If the element type `T` is specified, the server must have
+sent an array of this type and the result is a `N`-dimensional array with
+elements of type `T`.  Other arguments and keywords are as for
+[`XPA.get`](@ref).
+
+See also [`XPA.get_data`](@ref).
+
+"""
+function get(::Type{Array}, args...; kwds...) :: Array
+    _get1(args...; kwds...) do rep
+        get_data(Array, rep)
+    end
+end
+
+function get(::Type{Array{T}}, args...; kwds...) :: Array{T} where {T}
+    _get1(args...; kwds...) do rep
+        get_data(Array{T}, rep)
+    end
+end
+
+"""
+```julia
+XPA.get_data(Array, rep, i=1; preserve=false) -> arr
+XPA.get_data(Array{T}, rep, i=1; preserve=false) -> arr
+```
+
+yield the framed array sent by the `i`-th server in XPA answer `rep`, see
+[`XPA.get`](@ref).  Unless keyword
+`preserve` is true, the elements are moved in place in the buffer of the
+answer which is given to the result, hence avoiding allocating another array.
+
+"""
+get_data(::Type{Array}, rep::Reply, i::Integer = 1;
+         preserve::Bool = false) :: Array =
+    _get_framed(rep, Int(i), preserve)
+
+get_data(::Type{Array{T}}, rep::Reply, i::Integer = 1;
+         preserve::Bool = false) :: Array{T} where {T} =
+    _get_framed(Array{T}, rep, Int(i), preserve)
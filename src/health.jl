@@ -0,0 +1,204 @@
+#
+# health.jl --
+#
+# Track the health of the access points used by XPA clients.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# The health of the access points is recorded for the whole process, so
+# that all client connections (the per-task ones, those of the connection
+# pools and those of the requests with a deadline) share the same state.
+# After `_BREAKER_THRESHOLD` consecutive failures, the circuit of the access
+# point is open: requests fail immediately until a delay, which doubles with
+# each failure (from `_BACKOFF_MIN` to `_BACKOFF_MAX` seconds and randomized
+# to avoid synchronizing clients) has elapsed.  The next request is then sent
+# (the circuit is half-open) while the others keep failing fast for another
+# delay: its success closes the circuit.  No extra probe is sent, so a
+# request run by `@threadcall` never blocks the thread of the caller.
+const _BREAKER_THRESHOLD = 3
+const _BACKOFF_MIN = 0.1
+const _BACKOFF_MAX = 10.0
+const _HEALTH = Dict{String,Health}()
+const _HEALTH_LOCK = Threads.SpinLock()
+
+"""
+    XPA.health(apt) -> h
+
+yields the health of the XPA access point `apt` as seen by the clients of
+this process.  The result is an instance of [`XPA.Health`](@ref) with
+fields:
+
+* `h.last_success` the time (as given by `time()`) of the last successful
+  request, 0 if none;
+
+* `h.failures` the number of consecutive failed requests;
+
+* `h.retry_at` the time before which requests fail fast.
+
+A request fails if it yields no answers or if all its answers are errors
+of the XPA library meaning that the server could not be reached (the
+connection failed or timed out).  Errors answered by a server, for instance
+to reject an invalid command, do not count as failures.  Requests are
+tracked per access point string, as given to [`XPA.get`](@ref) or
+[`XPA.set`](@ref), whatever the client connection used to send them.
+After the first failure following a success, the client connection is
+re-open and an [`XPA.get`](@ref) request is sent again.  This recovers
+transparently from a server restarted on the same address.  An
+[`XPA.set`](@ref) request, which may not be idempotent, is only sent again
+if it has keyword `retry=true`.  After 3 consecutive failures, the requests
+to the access point fail immediately with an error answer (the circuit is
+open) for a delay which grows exponentially with the number of failures (up
+to 10 seconds).  A single request is then sent to the server and, if it
+succeeds, requests are allowed again.  Hot loops of requests to a dead
+server therefore fail fast instead of waiting for `XPA_CONNECT_TIMEOUT` each
+time.
+
+The health of all access points is forgotten by
+[`XPA.reset_health!()`](@ref XPA.reset_health!), that of a given access
+point by `XPA.reset_health!(apt)`.
+
+"""
+function health(apt::AbstractString)
+    lock(_HEALTH_LOCK)
+    try
+        h = Base.get(_HEALTH, apt, nothing)
+        return (h === nothing ? Health(0.0, 0, 0.0) :
+                Health(h.last_success, h.failures, h.retry_at))
+    finally
+        unlock(_HEALTH_LOCK)
+    end
+end
+
+"""
+    XPA.reset_health!([apt])
+
+forgets the health of the access point `apt` (of all access points by
+default), see [`XPA.health`](@ref).
+
+"""
+function reset_health!()
+    lock(_HEALTH_LOCK)
+    try
+        empty!(_HEALTH)
+    finally
+        unlock(_HEALTH_LOCK)
+    end
+    return nothing
+end
+
+function reset_health!(apt::AbstractString)
+    lock(_HEALTH_LOCK)
+    try
+        delete!(_HEALTH, apt)
+    finally
+        unlock(_HEALTH_LOCK)
+    end
+    return nothing
+end
+
+Base.show(io::IO, h::Health) =
+    print(io, "XPA.Health(last_success=", h.last_success, ", failures=",
+          h.failures, ", retry_at=", h.retry_at, ")")
+
+# Yield whether a request to `apt` must fail immediately because its circuit
+# is open.
+function _fail_fast(apt::AbstractString)
+    lock(_HEALTH_LOCK)
+    try
+        h = Base.get(_HEALTH, apt, nothing)
+        (h === nothing || h.failures < _BREAKER_THRESHOLD) && return false
+        time() < h.retry_at && return true
+        # Let this request test whether the server has recovered, the other
+        # ones fail fast until it completes.
+        h.retry_at = time() + _backoff(h.failures)
+        return false
+    finally
+        unlock(_HEALTH_LOCK)
+    end
+end
+
+_backoff(failures::Int) =
+    min(_BACKOFF_MAX, _BACKOFF_MIN*2.0^(failures - _BREAKER_THRESHOLD))*
+    (0.5 + 0.5*rand())
+
+# Build the answer of a request which fails fast.
+_circuit_reply(apt::AbstractString) =
+    _error_reply(apt, string("access point not responding (",
+                             health(apt).failures, " consecutive failures)"))
+
+# Update the health of `apt` after a request whose `replies` answers are in
+# `rep`.  Yield whether the request must be sent again after having re-open
+# the client connection `conn` (only if `retry` is true), in which case the
+# answers are discarded.
+function _track!(conn::Client, apt::AbstractString, rep::Reply,
+                 replies::Integer, retry::Bool)
+    failed = _failed(rep, replies)
+    lock(_HEALTH_LOCK)
+    try
+        h = Base.get(_HEALTH, apt, nothing)
+        if h === nothing
+            h = Health(0.0, 0, 0.0)
+            _HEALTH[String(apt)] = h
+        end
+        if !failed
+            h.last_success = time()
+            h.failures = 0
+            h.retry_at = 0.0
+            return false
+        end
+        # The persistent connection to the server may be stale.
+        retry = (retry && h.failures == 0 && h.last_success > 0)
+        if !retry
+            h.failures += 1
+            if h.failures ≥ _BREAKER_THRESHOLD
+                h.retry_at = time() + _backoff(h.failures)
+            end
+        end
+    finally
+        unlock(_HEALTH_LOCK)
+    end
+    if retry
+        rep.replies = clamp(replies, 0, _nmax(rep))
+        _free(rep)
+        rep.replies = 0
+        _reopen!(conn)
+    end
+    return retry
+end
+
+# Yield whether a request has failed to reach the server(s): no answers or
+# only connection errors.
+function _failed(rep::Reply, replies::Integer)
+    nmax = _nmax(rep)
+    1 ≤ replies ≤ nmax || return true
+    for i in 1:replies
+        _is_connection_error(rep.buffers[i + 2*nmax]) || return false
+    end
+    return true
+end
+
+# Beginnings of the error messages set by the XPA library or by
+# `_error_reply` (not by the server) when the server cannot be reached.  The
+# messages answered by a server follow the same prefix, so they are only
+# matched at its end: a server answering "timeout reading camera" is alive.
+const _CONNECTION_ERRORS = map(str -> Tuple(map(Byte, collect(
+    _XPA_ERROR_PREFIX*str))), ("no response from server",
+                               "no 'xpaget' access points match",
+                               "no 'xpaset' access points match",
+                               "no 'xpainfo' access points match",
+                               "request timed out",
+                               "access point not responding"))
+
+# Yield whether the message at `ptr` is a connection error.
+_is_connection_error(ptr::Ptr{Byte}) =
+    any(tup -> _startswith(ptr, tup), _CONNECTION_ERRORS)
+
+function _reopen!(conn::Client)
+    close(conn)
+    conn.ptr = _open()
+    return conn
+end
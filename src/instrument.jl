@@ -0,0 +1,192 @@
+#
+# instrument.jl --
+#
+# Collect statistics about the requests served by or sent to XPA servers.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# Instrumentation is guarded by calls to `_instrumented()` which is a constant
+# function redefined by `instrument!`.  When it yields false, the compiler
+# eliminates the instrumentation code, so there is no overhead at all.
+_instrumented() = false
+
+const _STATS = Dict{Tuple{Symbol,String,String},RequestStats}()
+const _STATS_LOCK = Threads.SpinLock()
+
+"""
+```julia
+XPA.instrument!(flag=true)
+```
+
+enables or disables the collection of statistics about the requests sent by
+the XPA clients and served by the XPA servers of the process.  The statistics
+are retrieved by [`XPA.stats`](@ref).  When instrumentation is disabled
+(which is the default), the code collecting statistics is eliminated by the
+compiler.  Changing the setting causes the compilation again of the methods
+performing requests.
+
+"""
+function instrument!(flag::Bool = true)
+    if flag != _instrumented()
+        @eval _instrumented() = $flag
+    end
+    return nothing
+end
+
+"""
+```julia
+XPA.isinstrumented()
+```
+
+yields whether Julia XPA package collects statistics about requests, see
+[`XPA.instrument!`](@ref).
+
+"""
+isinstrumented() = Base.invokelatest(_instrumented)
+
+"""
+```julia
+XPA.stats() -> dict
+```
+
+yields a snapshot of the statistics collected about the requests since
+instrumentation has been enabled (see [`XPA.instrument!`](@ref)) or since
+the last call to [`XPA.reset_stats!`](@ref).  The result is a dictionary
+whose keys are tuples `(side, target, verb)` and values are instances of
+[`XPA.RequestStats`](@ref).  Here `side` is `:client` for the requests sent
+by the process and `:server` for the requests served by the process, `target`
+is the access point (as given to [`XPA.get`](@ref) and [`XPA.set`](@ref)) or
+the `CLASS:NAME` of the server and `verb` is the first word of the parameter
+list.  Time spent in [`XPA.find`](@ref) to query the name server is
+accounted for the key `(:client, ident, "")`.
+
+"""
+function stats()
+    lock(_STATS_LOCK)
+    try
+        return Dict(key => _copy(val) for (key, val) in _STATS)
+    finally
+        unlock(_STATS_LOCK)
+    end
+end
+
+"""
+```julia
+XPA.reset_stats!()
+```
+
+discards all the statistics collected about requests.
+
+"""
+function reset_stats!()
+    lock(_STATS_LOCK)
+    try
+        empty!(_STATS)
+    finally
+        unlock(_STATS_LOCK)
+    end
+    return nothing
+end
+
+function _copy(st::RequestStats)
+    cpy = RequestStats()
+    for name in (:count, :errors, :bytes_in, :bytes_out,
+                 :lookup_time, :request_time, :callback_time)
+        setfield!(cpy, name, getfield(st, name))
+    end
+    copyto!(cpy.latency.counts, st.latency.counts)
+    return cpy
+end
+
+Base.push!(hist::Histogram, t::Integer) =
+    (@inbounds hist.counts[65 - leading_zeros(UInt64(t))] += 1; hist)
+
+Base.sum(hist::Histogram) = sum(hist.counts)
+
+function Base.show(io::IO, st::RequestStats)
+    print(io, "XPA.RequestStats(count=", st.count, ", errors=", st.errors,
+          ", bytes_in=", st.bytes_in, ", bytes_out=", st.bytes_out,
+          ", lookup_time=", st.lookup_time, " ns, request_time=",
+          st.request_time, " ns, callback_time=", st.callback_time, " ns)")
+end
+
+function Base.show(io::IO, ::MIME"text/plain", hist::Histogram)
+    print(io, "XPA.Histogram of ", sum(hist), " durations:")
+    for k in 1:length(hist.counts)
+        (n = hist.counts[k]) > 0 || continue
+        print(io, "\n  < ", UInt128(1) << (k - 1), " ns: ", n)
+    end
+end
+
+# Apply `f(st)` to the statistics for `key` with the lock held.
+function _update_stats!(f::Function, key::Tuple{Symbol,String,String})
+    lock(_STATS_LOCK)
+    try
+        st = Base.get(_STATS, key, nothing)
+        if st === nothing
+            st = RequestStats()
+            _STATS[key] = st
+        end
+        f(st)
+    finally
+        unlock(_STATS_LOCK)
+    end
+    return nothing
+end
+
+# Yield the first word of a parameter list (ignoring options, see
+# `_request_options`).
+function _verb(params::AbstractString)
+    words = split(params)
+    k = (length(words) ≥ 1 && startswith(words[1], _OPTIONS_PREFIX) ? 2 : 1)
+    return (k ≤ length(words) ? String(words[k]) : "")
+end
+
+# Record a client request whose answers are in `rep`.
+function _record_client!(apt::AbstractString, params::AbstractString,
+                         dt::UInt64, rep::Reply, replies::Integer,
+                         bytes_out::Integer)
+    if 0 ≤ replies ≤ _nmax(rep)
+        rep.replies = replies
+    end
+    errors = 0
+    bytes_in = 0
+    for i in 1:length(rep)
+        has_error(rep, i) && (errors += 1)
+        bytes_in += Int(rep.lengths[i])
+    end
+    _update_stats!((:client, String(apt), _verb(params))) do st
+        st.count += 1
+        st.errors += errors
+        st.bytes_in += bytes_in
+        st.bytes_out += bytes_out
+        st.request_time += dt
+        push!(st.latency, dt)
+    end
+end
+
+# Record the time spent in querying the name server.
+_record_lookup!(ident::AbstractString, dt::UInt64) =
+    _update_stats!((:client, String(ident), "")) do st
+        st.lookup_time += dt
+    end
+
+# Record a request served by `srv`.
+function _record_server!(srv::Server, params::Ptr{Byte}, dt::UInt64,
+                         status::Integer, bytes_in::Integer,
+                         bytes_out::Integer)
+    verb, args = _split_command(params)
+    _update_stats!((:server, get_class(srv)*":"*get_name(srv),
+                    String(verb))) do st
+        st.count += 1
+        status == SUCCESS || (st.errors += 1)
+        st.bytes_in += bytes_in
+        st.bytes_out += bytes_out
+        st.callback_time += dt
+        push!(st.latency, dt)
+    end
+end
@@ -13,14 +13,71 @@
 # CONFIGURATION METHODS
 
 # The following default values are defined in "xpap.c" and can be changed by
-# user environment variables.
-const _DEFAULTS = Dict{String,Any}("XPA_MAXHOSTS" => 100,
-                                   "XPA_SHORT_TIMEOUT" => 15,
-                                   "XPA_LONG_TIMEOUT" => 180,
-                                   "XPA_CONNECT_TIMEOUT" => 10,
-                                   "XPA_TMPDIR" => "/tmp/.xpa",
-                                   "XPA_VERBOSITY" => true,
-                                   "XPA_IOCALLSXPA" => false)
+# user environment variables.  The names of the parameters are in the same
+# order as the fields of `XPA.Config`.  The last one is specific to XPA.jl,
+# its default value depends on the size of the thread pool of libuv.
+const _CONFIG_KEYS = ("XPA_MAXHOSTS",
+                      "XPA_SHORT_TIMEOUT",
+                      "XPA_LONG_TIMEOUT",
+                      "XPA_CONNECT_TIMEOUT",
+                      "XPA_TMPDIR",
+                      "XPA_VERBOSITY",
+                      "XPA_IOCALLSXPA",
+                      "XPA_MAXABANDONED")
+const _DEFAULTS = Config(100, 15, 180, 10, "/tmp/.xpa", 1, false, 2)
+
+# The configuration is loaded from the environment by `__init__` and by
+# `setconfig!`.  It is an immutable object, so reading `_CONFIG[]` is
+# thread-safe and the type of its fields is known by the compiler.
+const _CONFIG = Ref(_DEFAULTS)
+
+function _load_config()
+    vals = ntuple(i -> _load_config(_CONFIG_KEYS[i], getfield(_DEFAULTS, i)),
+                  Val(length(_CONFIG_KEYS)))
+    return Config(vals...)
+end
+
+function _load_config(key::String, def::T) where {T}
+    key == "XPA_MAXABANDONED" && (def = _default_maxabandoned())
+    str = Base.get(ENV, key, nothing)
+    str === nothing && return def
+    val = (key == "XPA_VERBOSITY" ? _parse_verbosity(strip(str)) :
+           _parse_config(T, strip(str)))
+    if val === nothing
+        @warn "invalid value \"$str\" of environment variable $key, using default value $def"
+        return def
+    end
+    return val
+end
+
+# At most half of the threads of libuv pool (4 by default, shared with other
+# I/O operations of Julia) can be kept by abandoned requests.
+function _default_maxabandoned()
+    n = tryparse(Int, Base.get(ENV, "UV_THREADPOOL_SIZE", "4"))
+    return max(1, (n === nothing ? 4 : n) ÷ 2)
+end
+
+_parse_config(::Type{String}, str::AbstractString) = String(str)
+_parse_config(::Type{Int}, str::AbstractString) = tryparse(Int, str)
+function _parse_config(::Type{Bool}, str::AbstractString)
+    val = tryparse(Int, str)
+    val === nothing || return val != 0
+    str = lowercase(str)
+    return (str ∈ ("true", "yes", "on") ? true :
+            str ∈ ("false", "no", "off") ? false : nothing)
+end
+
+# The verbosity is a level, boolean values are also accepted for 0 and 1.
+function _parse_verbosity(str::AbstractString)
+    val = _parse_config(Int, str)
+    val === nothing || return val
+    flag = _parse_config(Bool, str)
+    return (flag === nothing ? nothing : Int(flag))
+end
+
+_config_index(key::AbstractString) =
+    (i = findfirst(isequal(key), _CONFIG_KEYS)) === nothing ?
+    error("unknown XPA parameter \"$key\"") : i
 
 """
 ```julia
@@ -38,25 +95,37 @@ information):
 | `"XPA_LONG_TIMEOUT"`    | `180`         |
 | `"XPA_CONNECT_TIMEOUT"` | `10`          |
 | `"XPA_TMPDIR"`          | `"/tmp/.xpa"` |
-| `"XPA_VERBOSITY"`       | `true`        |
+| `"XPA_VERBOSITY"`       | `1`           |
 | `"XPA_IOCALLSXPA"`      | `false`       |
+| `"XPA_MAXABANDONED"`    | see below     |
+
+The values are read from the environment variables of the same names when
+the package is loaded and when [`XPA.setconfig!`](@ref) is called, not by
+each call to `XPA.getconfig`.  The verbosity is an integer level (0 for no
+messages), `true` and `false` are accepted for 1 and 0.  Parameter
+`"XPA_MAXABANDONED"` is specific to XPA.jl, it is the number of abandoned
+requests with a time limit (see keyword `timeout` of [`XPA.get`](@ref)) still
+running above which new requests with a time limit fail immediately.  It is
+half the size of the thread pool of libuv (`UV_THREADPOOL_SIZE`, 4 by
+default) by default.  All values are given by [`XPA.config()`](@ref
+XPA.config).
 
 Also see [`XPA.setconfig!`](@ref).
 
 """
-function getconfig(key::AbstractString)
-    haskey(_DEFAULTS, key) || error("unknown XPA parameter \"$key\"")
-    def = _DEFAULTS[key]
-    if haskey(ENV, key)
-        val = haskey(ENV, key)
-        return (isa(def, Bool) ? (parse(Int, val) != 0) :
-                isa(def, Integer) ? parse(Int, val) :
-                isa(def, AbstractString) ? val :
-                error("unexpected type $(typeof(def)) for default value of \"$key\""))
-    else
-        return def
-    end
-end
+getconfig(key::AbstractString) = getfield(_CONFIG[], _config_index(key))
+
+"""
+```julia
+XPA.config() -> cfg
+```
+
+yields the current configuration of XPA as an instance of
+[`XPA.Config`](@ref).  This is faster than [`XPA.getconfig`](@ref) and the
+type of the fields of `cfg` is known.
+
+"""
+config() = _CONFIG[]
 
 """
 ```julia
@@ -64,25 +133,29 @@ XPA.setconfig!(key, val) -> oldval
 ```
 
 set the value associated with configuration parameter `key` to be `val`.  The
-previous value is returned.
+previous value is returned.  The environment variable `key` is set so that
+the value is also used by the XPA library and by child processes, then the
+configuration is read again from all the environment variables.
 
 Also see [`XPA.getconfig`](@ref).
 
 """
 function setconfig!(key::AbstractString,
                     val::T) where {T<:Union{Integer,Bool,AbstractString}}
-    global _DEFAULTS, ENV
-    old = getconfig(key) # also check validity of key
-    def = _DEFAULTS[key]
-    if isa(def, Integer) && isa(val, Integer)
-        ENV[key] = string(val)
-    elseif isa(def, Bool) && isa(val, Bool)
+    i = _config_index(key) # also check validity of key
+    S = fieldtype(Config, i)
+    old = getfield(_CONFIG[], i)
+    if S === Bool && isa(val, Bool)
         ENV[key] = (val ? "1" : "0")
-    elseif isa(def, AbstractString) && isa(val, AbstractString)
+    elseif S === Int && isa(val, Integer) &&
+        (!isa(val, Bool) || key == "XPA_VERBOSITY")
+        ENV[key] = string(Int(val))
+    elseif S === String && isa(val, AbstractString)
         ENV[key] = val
     else
         error("invalid type for XPA parameter \"$key\"")
     end
+    _CONFIG[] = _load_config()
     return old
 end
 
@@ -135,6 +208,16 @@ let T = CDefs.XPARec, off = fieldoffset(T, Base.fieldindex(T, :comm, true))
         _get_field(Ptr{Cvoid}, conn.ptr, $off, C_NULL)
 end
 
+# Offsets of the fields needed to walk the sockets of XPA servers.
+for (name, T, memb) in ((:_XPA_FD_OFFSET,       CDefs.XPARec,     :fd),
+                        (:_XPA_COMMHEAD_OFFSET, CDefs.XPARec,     :commhead),
+                        (:_COMM_NEXT_OFFSET,    CDefs.XPACommRec, :next),
+                        (:_COMM_CMDFD_OFFSET,   CDefs.XPACommRec, :cmdfd),
+                        (:_COMM_DATAFD_OFFSET,  CDefs.XPACommRec, :datafd))
+    off = fieldoffset(T, Base.fieldindex(T, memb, true))
+    @eval const $name = $off
+end
+
 for (func, memb, defval) in ((:get_name,      :name,         ""),
                              (:get_class,     :xclass,       ""),
                              (:get_send_mode, :send_mode,    0),
@@ -230,3 +313,90 @@ function _memcpy!(dst::AbstractArray, src::Ptr, len::Integer)
     end
     return dst
 end
+
+#------------------------------------------------------------------------------
+# STRING VIEWS
+
+"""
+```julia
+XPA.StringView(ptr, len)
+XPA.StringView(ptr)
+```
+
+yields a string view of the `len` bytes at address `ptr`.  If `len` is not
+specified, `ptr` is assumed to be the address of a null-terminated string.
+The view is empty if `ptr` is NULL.  Nothing is copied, see
+[`XPA.StringView`](@ref) type for restrictions.
+
+"""
+StringView(ptr::Ptr{Byte}) =
+    StringView(ptr, (ptr == NULL ? 0 :
+                     Int(ccall(:strlen, Csize_t, (Ptr{Byte},), ptr))))
+
+Base.ncodeunits(str::StringView) = str.len
+Base.codeunit(str::StringView) = Byte
+@propagate_inbounds function Base.codeunit(str::StringView, i::Integer)
+    @boundscheck checkbounds(str, i)
+    return unsafe_load(str.ptr, i)
+end
+Base.sizeof(str::StringView) = str.len
+Base.pointer(str::StringView) = str.ptr
+Base.pointer(str::StringView, i::Integer) = str.ptr + (i - 1)
+Base.String(str::StringView) =
+    (str.len > 0 ? unsafe_string(str.ptr, str.len) : "")
+Base.write(io::IO, str::StringView) = unsafe_write(io, str.ptr, str.len)
+
+Base.isvalid(str::StringView, i::Integer) =
+    (checkbounds(Bool, str, i) && (unsafe_load(str.ptr, i) & 0xc0) != 0x80)
+
+@inline function Base.iterate(str::StringView, i::Int = 1)
+    i > str.len && return nothing
+    b = unsafe_load(str.ptr, i)
+    b < 0x80 && return (reinterpret(Char, UInt32(b) << 24), i + 1)
+    # Decode a multi-byte UTF-8 sequence (an invalid sequence yields an invalid
+    # character as for other Julia strings).
+    n = (b ≥ 0xf0 ? 4 : b ≥ 0xe0 ? 3 : b ≥ 0xc0 ? 2 : 1)
+    u = UInt32(b) << 24
+    k = 1
+    while k < n && i + k ≤ str.len
+        c = unsafe_load(str.ptr, i + k)
+        (c & 0xc0) == 0x80 || break
+        u |= UInt32(c) << (24 - 8k)
+        k += 1
+    end
+    return (reinterpret(Char, u), i + k)
+end
+
+# Comparisons do not allocate.
+Base.:(==)(a::StringView, b::StringView) = _same(a, b)
+Base.:(==)(a::StringView, b::String) = _same(a, b)
+Base.:(==)(a::String, b::StringView) = _same(b, a)
+
+function _same(a::StringView, b::Union{String,StringView})
+    (len = sizeof(a)) == sizeof(b) || return false
+    GC.@preserve b begin
+        return (a.ptr == pointer(b) ||
+                ccall(:memcmp, Cint, (Ptr{Byte}, Ptr{Byte}, Csize_t),
+                      a.ptr, pointer(b), len) == 0)
+    end
+end
+
+"""
+```julia
+_fnv1a(ptr, len)
+_fnv1a(str)
+```
+
+yields the 64-bit FNV-1a hash of the `len` bytes at address `ptr` or of the
+bytes of string `str`.
+
+"""
+function _fnv1a(ptr::Ptr{Byte}, len::Integer)
+    h = 0xcbf29ce484222325
+    @inbounds for i in 1:len
+        h = (h ⊻ unsafe_load(ptr, i))*0x00000100000001b3
+    end
+    return h
+end
+_fnv1a(str::StringView) = _fnv1a(str.ptr, str.len)
+_fnv1a(str::String) = GC.@preserve str _fnv1a(pointer(str), sizeof(str))
@@ -0,0 +1,69 @@
+#
+# precompile.jl --
+#
+# Precompilation directives to reduce the latency of the first requests.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# The methods retrieving or serving data are specialized on the element type
+# and the number of dimensions of arrays.  The following directives compile,
+# when the package is precompiled, the methods for the most common element
+# types and dimensionalities.  Requests cannot be executed at that time (no
+# name server may be running), so the methods are only compiled for their
+# argument types.
+const _PRECOMPILE_TYPES = (UInt8, Int16, UInt16, Int32, Int64, Float32, Float64)
+
+function _precompile()
+    # Client side.
+    for func in (get, set)
+        precompile(func, (String, String))
+        precompile(func, (Client, String, String))
+        precompile(func, (Function, String, String))
+    end
+    precompile(get, (Type{String}, String, String))
+    precompile(get_data, (Type{String}, Reply, Int))
+    precompile(list, (Client,))
+    precompile(find, (Client, String))
+    precompile(address, (String,))
+    precompile(Core.kwfunc(set),
+               (NamedTuple{(:data,),Tuple{String}}, typeof(set),
+                String, String))
+    for T in _PRECOMPILE_TYPES
+        precompile(get, (Type{Vector{T}}, String, String))
+        precompile(get, (Type{T}, String, String))
+        precompile(get, (Type{NTuple{2,T}}, String, String))
+        precompile(get_data, (Type{Vector{T}}, Reply, Int))
+        precompile(peek, (Type{T}, ReceiveBuffer, Int))
+        precompile(peek, (Type{Vector{T}}, ReceiveBuffer))
+        for N in 1:3
+            precompile(get, (Type{Array{T,N}}, NTuple{N,Int}, String, String))
+            precompile(get_data, (Type{Array{T,N}}, NTuple{N,Int}, Reply, Int))
+            precompile(_get_buf, (Type{Array{T,N}}, NTuple{N,Int}, Reply,
+                                  Int, Bool))
+            precompile(peek, (Type{Array{T,N}}, NTuple{N,Int},
+                              ReceiveBuffer))
+            precompile(store!, (SendBuffer, Array{T,N}))
+            precompile(Core.kwfunc(set),
+                       (NamedTuple{(:data,),Tuple{Array{T,N}}}, typeof(set),
+                        String, String))
+        end
+    end
+
+    # Server side.
+    precompile(_send, (Ptr{Cvoid}, Ptr{Cvoid}, Ptr{Byte}, Ptr{Ptr{Byte}},
+                       Ptr{Csize_t}))
+    precompile(_recv, (Ptr{Cvoid}, Ptr{Cvoid}, Ptr{Byte}, Ptr{Byte},
+                       Csize_t))
+    precompile(_unpin, (Ptr{Cvoid},))
+    precompile(store!, (SendBuffer, String))
+    precompile(store!, (SendBuffer, Nothing))
+    precompile(poll, (Int, Int))
+    precompile(mainloop, ())
+    return nothing
+end
+
+ccall(:jl_generating_output, Cint, ()) == 1 && _precompile()
@@ -0,0 +1,193 @@
+#
+# publish.jl --
+#
+# Implement XPA servers publishing a value to many clients.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# The buffer of a published value is made of a 16-byte header followed by the
+# payload.  The header is:
+#
+#     bytes 1-4   magic "XPAV"
+#     bytes 5-8   unused (zero)
+#     bytes 9-16  version as a little-endian 64-bit integer
+#
+# A new buffer is built by each update and is never modified, so the same
+# buffer can be shared by all the pending requests (see `_share!`).  The size
+# of the header preserves the alignment of the payload.
+const _PUBLISHED_MAGIC = (0x58, 0x50, 0x41, 0x56) # "XPAV"
+const _PUBLISHED_HEADER = 16
+
+function _published_buffer(ptr::Ptr{Byte}, len::Integer, version::Integer)
+    buf = Vector{Byte}(undef, _PUBLISHED_HEADER + len)
+    GC.@preserve buf begin
+        dst = pointer(buf)
+        for i in 1:4
+            unsafe_store!(dst, _PUBLISHED_MAGIC[i], i)
+        end
+        _store_le(dst + 4, UInt32(0))
+        _store_le(dst + 8, UInt64(version))
+        len > 0 && _memcpy!(dst + _PUBLISHED_HEADER, ptr, len)
+    end
+    return buf
+end
+
+# Yield the version of the published value whose buffer is at `ptr`.
+function _published_version(ptr::Ptr{Byte}, len::Integer)
+    (ptr != NULL && len ≥ _PUBLISHED_HEADER &&
+     unsafe_load(ptr, 1) == _PUBLISHED_MAGIC[1] &&
+     unsafe_load(ptr, 2) == _PUBLISHED_MAGIC[2] &&
+     unsafe_load(ptr, 3) == _PUBLISHED_MAGIC[3] &&
+     unsafe_load(ptr, 4) == _PUBLISHED_MAGIC[4]) ||
+         error("data is not a published value")
+    return Int(_load_le(UInt64, ptr + 8))
+end
+
+Published(data) = publish!(Published(), data)
+
+"""
+```julia
+XPA.publish!(pub, data) -> pub
+```
+
+updates the value published by `pub`, an instance of [`XPA.Published`](@ref),
+with the contents of `data` which can be `nothing`, a dense array or a string
+(as the data of [`XPA.set`](@ref)).  The bytes of `data` are copied once in
+an immutable buffer which is handed directly to XPA (as with
+`XPA.store!(buf, data; share=true)`) for all the [`XPA.get`](@ref) requests
+served until the next update.  The version of the published value, given by
+[`XPA.version(pub)`](@ref XPA.version), is incremented.  The buffer of the
+previous version is released when the requests still sending it complete.
+
+A server publishing `pub` is created by:
+
+```julia
+srv = XPA.Server(class, name, help, pub)
+```
+
+Such a server never calls any Julia callback to serve a request, its answer
+depends on the parameter list of the request:
+
+- `""` yields the bytes of the published value;
+
+- `"version"` yields the version of the published value in textual form;
+
+- `"since \$ver"` yields the published value preceded by a header if its
+  version is not `ver`, an empty answer otherwise.  This is used by
+  [`XPA.wait_update`](@ref).
+
+"""
+function publish!(pub::Published, data)
+    buf = buffer(data)
+    version = pub.version + 1
+    GC.@preserve buf begin
+        # The buffer is replaced before the version is incremented so that
+        # the callback always serves a consistent buffer.
+        pub.buffer = _published_buffer(Ptr{Byte}(pointer(buf)),
+                                       sizeof(buf), version)
+    end
+    pub.version = version
+    return pub
+end
+
+"""
+```julia
+XPA.version(pub) -> ver
+```
+
+yields the version of the value published by `pub`, an instance of
+[`XPA.Published`](@ref).  The version is incremented by each call to
+[`XPA.publish!`](@ref), it is 0 if no value has been published yet.
+
+"""
+version(pub::Published) = pub.version
+
+Base.show(io::IO, pub::Published) =
+    print(io, "XPA.Published(version=", pub.version, ", ",
+          length(pub.buffer) - _PUBLISHED_HEADER, " bytes)")
+
+function _send_published(pub::Published, srv::Server, params::String,
+                         buf::SendBuffer)
+    obj = pub.buffer
+    ptr = pointer(obj)
+    len = length(obj)
+    words = split(params)
+    if length(words) == 0
+        _share!(buf, obj, ptr + _PUBLISHED_HEADER, len - _PUBLISHED_HEADER)
+    elseif words[1] == "version" && length(words) == 1
+        store!(buf, string(_published_version(ptr, len)))
+    elseif words[1] == "since" && length(words) == 2
+        ver = tryparse(Int, words[2])
+        ver === nothing && return error(srv, "invalid version \"$(words[2])\"")
+        ver == _published_version(ptr, len) || _share!(buf, obj, ptr, len)
+    else
+        return error(srv, "invalid parameters \"$params\" for a published value")
+    end
+    return SUCCESS
+end
+
+function Server(class::AbstractString, name::AbstractString,
+                help::AbstractString, pub::Published,
+                recv::Union{ReceiveCallback, Nothing} = nothing)
+    # Compression is disabled as it would copy the shared buffer.
+    return Server(class, name, help,
+                  SendCallback(_send_published, pub; compress = false), recv)
+end
+
+"""
+```julia
+XPA.wait_update([conn,] apt, ver=-1; timeout=Inf, interval=0.05) -> (ver, data)
+```
+
+waits until the version of the value published by the XPA server at
+access point `apt` is different from `ver` and yields the new version and the
+bytes of the published value.  If no update occurs before `timeout` seconds,
+`nothing` is returned.  This is the client side of [`XPA.publish!`](@ref):
+with the default `ver=-1`, the current published value is returned
+immediately.  Typical loop of a client:
+
+```julia
+ver = -1
+while true
+    ver, data = XPA.wait_update(apt, ver)
+    ... # process data
+end
+```
+
+XPA servers process one request at a time, so the server cannot defer its
+answer until the next update: the client repeats the request every
+`interval` seconds (yielding to other tasks meanwhile) while the value has
+not changed.  These requests are cheap as the server answers them with no
+data and without calling any Julia callback.
+
+Optional argument `conn` and keyword `mode` are as for [`XPA.get`](@ref).
+
+"""
+wait_update(apt::Union{AbstractString,AccessPoint}, args...; kwds...) =
+    wait_update(connection(), apt, args...; kwds...)
+
+function wait_update(conn::Client, apt::Union{AbstractString,AccessPoint},
+                     ver::Integer = -1;
+                     timeout::Real = Inf,
+                     interval::Real = 0.05,
+                     mode::AbstractString = "")
+    timeout ≥ 0 || throw(ArgumentError("timeout must be nonnegative"))
+    interval > 0 || throw(ArgumentError("interval must be positive"))
+    deadline = time() + timeout
+    while true
+        ans = _get1(conn, apt, "since", ver; mode = mode) do rep
+            ptr, len = _get_buf(rep, 1, true)
+            len == 0 && return nothing
+            (_published_version(ptr, len),
+             _memcpy!(Vector{Byte}(undef, len - _PUBLISHED_HEADER),
+                      ptr + _PUBLISHED_HEADER, len - _PUBLISHED_HEADER))
+        end
+        ans === nothing || return ans
+        time() + interval ≤ deadline || return nothing
+        sleep(interval)
+    end
+end
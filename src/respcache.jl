@@ -0,0 +1,172 @@
+#
+# respcache.jl --
+#
+# Implement caches of the answers of XPA send callbacks.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# A cached answer is a buffer which is never modified, it is handed directly
+# to XPA by `_share!` (as for a published value) so that a request served
+# from the cache neither calls the send function nor copies the answer.  An
+# evicted answer is kept alive until the requests still sending it complete.
+
+"""
+```julia
+XPA.responsecache(srv) -> cache
+```
+
+yields the cache of the answers of the send callback of the XPA server `srv`
+or `nothing` if the server has no such cache (see keyword `cache` of
+[`XPA.SendCallback`](@ref)).  Argument may also be the send callback.  The
+result is an instance of [`XPA.ResponseCache`](@ref) whose fields
+`cache.hits`, `cache.misses` and `cache.evictions` give statistics about the
+use of the cache.
+
+"""
+responsecache(cb::SendCallback) = cb.cache
+
+function responsecache(srv::Server)
+    lock(_XPA_LOCK)
+    try
+        cbs = Base.get(_SERVERS, srv.ptr, nothing)
+        return (cbs !== nothing && cbs[1] isa SendCallback ?
+                cbs[1].cache : nothing)
+    finally
+        unlock(_XPA_LOCK)
+    end
+end
+
+"""
+```julia
+XPA.invalidate_response!(srv[, params]) -> srv
+```
+
+discards the answers memorized by the cache of the send callback of the XPA
+server `srv` (see keyword `cache` of [`XPA.SendCallback`](@ref)).  If
+`params` is specified, only the answer to the requests with this exact
+parameter list is discarded.  Argument `srv` may also be the send callback or
+its cache.  This method shall be called by the server whenever the state on
+which the cached answers depend changes, for instance from the receive
+callback of the server.  Nothing is done if there is no cache.
+
+"""
+function invalidate_response!(srv::Union{Server,SendCallback},
+                              args::AbstractString...)
+    cache = responsecache(srv)
+    cache === nothing || invalidate_response!(cache, args...)
+    return srv
+end
+
+function invalidate_response!(cache::ResponseCache)
+    lock(cache.lock)
+    try
+        empty!(cache.entries)
+        cache.bytes = 0
+    finally
+        unlock(cache.lock)
+    end
+    return cache
+end
+
+function invalidate_response!(cache::ResponseCache, params::AbstractString)
+    lock(cache.lock)
+    try
+        entry = Base.get(cache.entries, params, nothing)
+        if entry !== nothing
+            cache.bytes -= _cost(params, entry)
+            delete!(cache.entries, params)
+        end
+    finally
+        unlock(cache.lock)
+    end
+    return cache
+end
+
+Base.length(cache::ResponseCache) = length(cache.entries)
+
+function Base.show(io::IO, cache::ResponseCache)
+    print(io, "XPA.ResponseCache(", length(cache.entries), " entries, ",
+          cache.bytes, "/", cache.maxbytes, " bytes, hits = ", cache.hits,
+          ", misses = ", cache.misses, ", evictions = ", cache.evictions, ")")
+end
+
+# Serve a request with the cache of a send callback.
+function _send_cached(cb::SendCallback, cache::ResponseCache, srv::Server,
+                      params::String, buf::SendBuffer)
+    data = _lookup(cache, params)
+    if data !== nothing
+        _share!(buf, data, pointer(data), length(data))
+        return SUCCESS
+    end
+    status = cb.send(cb.data, srv, params, buf)
+    if status == SUCCESS
+        ptr, len = unsafe_load(buf.bufptr), Int(unsafe_load(buf.lenptr))
+        if sizeof(params) + len ≤ cache.maxbytes
+            data = Vector{Byte}(undef, len)
+            len > 0 && _memcpy!(data, ptr, len)
+            _remember!(cache, params, data)
+        end
+    end
+    return status
+end
+
+# Size accounted for a cached answer: the parameter list is included so that
+# empty answers also count.
+_cost(params::AbstractString, entry::CachedAnswer) =
+    sizeof(params) + length(entry.data)
+
+# Yield the cached answer for `params` or `nothing`.
+function _lookup(cache::ResponseCache, params::String)
+    lock(cache.lock)
+    try
+        cache.clock += 1
+        entry = Base.get(cache.entries, params, nothing)
+        if entry === nothing
+            cache.misses += 1
+            return nothing
+        end
+        cache.hits += 1
+        entry.used = cache.clock
+        return entry.data
+    finally
+        unlock(cache.lock)
+    end
+end
+
+# Memorize the answer `data` for `params` and evict the least recently used
+# answers while the cache is too large.
+function _remember!(cache::ResponseCache, params::String, data::Vector{Byte})
+    lock(cache.lock)
+    try
+        old = Base.get(cache.entries, params, nothing)
+        old === nothing || (cache.bytes -= _cost(params, old))
+        entry = CachedAnswer(data, cache.clock)
+        cache.entries[params] = entry
+        cache.bytes += _cost(params, entry)
+        while cache.bytes > cache.maxbytes && length(cache.entries) > 1
+            _evict!(cache, params)
+        end
+    finally
+        unlock(cache.lock)
+    end
+    return nothing
+end
+
+# Evict the least recently used answer other than the one for `keep`.
+function _evict!(cache::ResponseCache, keep::String)
+    victim = keep
+    oldest = typemax(UInt64)
+    for (key, entry) in cache.entries
+        if entry.used < oldest && key != keep
+            victim, oldest = key, entry.used
+        end
+    end
+    cache.bytes -= _cost(victim, cache.entries[victim])
+    delete!(cache.entries, victim)
+    cache.evictions += 1
+    return nothing
+end
@@ -12,9 +12,28 @@
 # We must make sure that the `send` and `recv` callbacks exist during the life
 # of the server.  To that end, we use the following dictionary to maintain
 # references to callbacks while they are used by an XPA server.
-const _SERVERS = Dict{Ptr{Cvoid},Tuple{Union{SendCallback, Nothing},
+const _SERVERS = Dict{Ptr{Cvoid},Tuple{Union{SendCallback, Commands, Nothing},
                                        Union{ReceiveCallback, Nothing}}}()
 
+# The XPA library is not thread-safe: it has global lists of servers and
+# processes their requests in `XPAPoll`.  All calls to the XPA library which
+# create, close or process the requests of servers are done with `_XPA_LOCK`
+# held.  The lock also protects `_SERVERS`.  It is reentrant so that callbacks
+# (called while polling) may create or close servers.
+const _XPA_LOCK = ReentrantLock()
+
+# Register the callbacks `cbs` of the XPA server at `ptr`.
+function _root!(ptr::Ptr{Cvoid}, cbs::Tuple)
+    lock(_XPA_LOCK)
+    try
+        _SERVERS[ptr] = cbs
+    finally
+        unlock(_XPA_LOCK)
+    end
+    _notify_watchers()
+    return nothing
+end
+
 """
 ```julia
 XPA.Server(class, name, help, send, recv) -> srv
@@ -92,9 +111,30 @@ if no error occurs, or [`XPA.FAILURE`](@ref) to signal an error.  The Julia XPA
 package takes care of maintaining a reference on the client data and callback
 methods.
 
+The XPA library is not thread-safe and processes the requests of all the
+servers of the process in turn.  Callbacks are called by the thread and the
+task which processes the requests, that is which calls [`XPA.poll`](@ref) or
+[`XPA.mainloop`](@ref) or which has started [`XPA.watch`](@ref): at most one
+callback runs at any time.  Servers may be created or closed by any thread
+(the calls to the XPA library are serialized by a lock), but this waits for
+the request being processed (if any).  The servers of a process are not
+isolated from each other: there are no per-server loops and a lengthy
+request to one access point (for instance a large image) delays the requests
+to the other access points of the process until it completes.  A callback
+which has lengthy work to do should hand it over to other threads (see
+[`XPA.WorkQueue`](@ref)) to limit such delays.
+
+```julia
+XPA.Server(class, name, help, cmds::XPA.Commands) -> srv
+```
+
+yields an XPA server serving the table of sub-commands `cmds`, the help of
+the server lists the names of the commands after `help`.  See
+[`XPA.Commands`](@ref).
+
 See also [`XPA.poll`](@ref), [`XPA.mainloop`](@ref), [`XPA.store!`](@ref),
-[`XPA.SendCallback`](@ref), [`XPA.ReceiveCallback`](@ref) and
-[`XPA.peek`](@ref).
+[`XPA.SendCallback`](@ref), [`XPA.ReceiveCallback`](@ref),
+[`XPA.Commands`](@ref) and [`XPA.peek`](@ref).
 
 """
 function Server(class::AbstractString,
@@ -107,7 +147,7 @@ function Server(class::AbstractString,
     server = Server(class, name, help,
                     _callback(send), _context(send), _mode(send),
 	            _callback(recv), _context(recv), _mode(recv))
-    _SERVERS[server.ptr] = (send, recv)
+    _root!(server.ptr, (send, recv))
     return server
 end
 
@@ -115,15 +155,20 @@ function Server(class::AbstractString, name::AbstractString,
                 help::AbstractString,
                 sproc::Ptr{Cvoid}, sdata::Ptr{Cvoid}, smode::AbstractString,
                 rproc::Ptr{Cvoid}, rdata::Ptr{Cvoid}, rmode::AbstractString)
-    ptr = ccall((:XPANew, libxpa), Ptr{Cvoid},
-                (Cstring, Cstring, Cstring,
-	         Ptr{Cvoid}, Ptr{Cvoid}, Cstring,
-	         Ptr{Cvoid}, Ptr{Cvoid}, Cstring),
-                class, name, help,
-                sproc, sdata, smode,
-                rproc, rdata, rmode)
+    lock(_XPA_LOCK)
+    ptr = try
+        ccall((:XPANew, libxpa), Ptr{Cvoid},
+              (Cstring, Cstring, Cstring,
+	       Ptr{Cvoid}, Ptr{Cvoid}, Cstring,
+	       Ptr{Cvoid}, Ptr{Cvoid}, Cstring),
+              class, name, help,
+              sproc, sdata, smode,
+              rproc, rdata, rmode)
+    finally
+        unlock(_XPA_LOCK)
+    end
     ptr != C_NULL || error("failed to create an XPA server")
-    obj = finalizer(close, Server(ptr))
+    obj = finalizer(_finalize, Server(ptr))
     (get_send_mode(obj) & MODE_FREEBUF) != 0 ||
         error("send mode must have `freebuf` option set")
     return obj
@@ -138,21 +183,44 @@ _context(cb::Callback) = pointer_from_objref(cb)
 _mode(::Nothing) = ""
 _mode(cb::SendCallback) = "acl=$(cb.acl),freebuf=true"
 _mode(cb::ReceiveCallback) =
-    "acl=$(cb.acl),buf=true,fillbuf=true,freebuf=true"
+    (cb.stream ? "acl=$(cb.acl),buf=true,fillbuf=false,freebuf=false" :
+     "acl=$(cb.acl),buf=true,fillbuf=true,freebuf=true")
 
-# The following method is called upon garbage collection of an XPA server.
 function Base.close(srv::Server)
-    if (ptr = srv.ptr) != C_NULL
-        srv.ptr = C_NULL # avoid closing more than once!
-        ccall((:XPAFree, libxpa), Cint, (Ptr{Cvoid},), ptr)
-        haskey(_SERVERS, ptr) && pop!(_SERVERS, ptr)
+    found = false
+    lock(_XPA_LOCK)
+    try
+        if (ptr = srv.ptr) != C_NULL
+            srv.ptr = C_NULL # avoid closing more than once!
+            ccall((:XPAFree, libxpa), Cint, (Ptr{Cvoid},), ptr)
+            found = (pop!(_SERVERS, ptr, nothing) !== nothing)
+        end
+    finally
+        unlock(_XPA_LOCK)
+    end
+    found && _notify_watchers()
+    return nothing
+end
+
+# The following method is called upon garbage collection of an XPA server.
+# A finalizer must not wait for a lock, so closing the server is deferred to
+# the next garbage collection if the lock is held by another task.
+function _finalize(srv::Server)
+    if trylock(_XPA_LOCK)
+        try
+            close(srv)
+        finally
+            unlock(_XPA_LOCK)
+        end
+    else
+        finalizer(_finalize, srv)
     end
     return nothing
 end
 
 """
 ```julia
-SendCallback(func, data=nothing; acl=true)
+SendCallback(func, data=nothing; acl=true, compress=true, cache=0)
 ```
 
 yields an instance of `SendCallback` for sending the data requested by a call
@@ -163,6 +231,23 @@ associated contextual data.
 Keyword `acl` can be used to specify whether access control is enabled (true by
 default).
 
+Keyword `compress` specifies whether to compress the answer when the client
+asks for it (see keyword `compress` of [`XPA.get`](@ref)).  This is true by
+default.  The answer is compressed after the callback has returned, so the
+callback is the same whether the answer is compressed or not.
+
+Keyword `cache` specifies the maximum number of bytes of the answers
+memorized by the callback (0 by default, which disables caching).  With a
+cache, the answer stored by a successful call to `func` is memorized for the
+parameter list of the request and the subsequent requests with the same
+parameter list are served directly from the cache, without calling `func`
+nor copying the answer (as with `XPA.store!(...; share=true)`).  This is
+intended for answers which only depend on the parameter list and on some
+state of the server, the server must then call
+[`XPA.invalidate_response!`](@ref) when this state changes.  The least recently used answers are evicted when the cache
+is full.  Statistics about the cache are given by
+[`XPA.responsecache`](@ref).
+
 !!! note
     The `freebuf` option is not available because we are always assuming that
     the answer to a [`XPA.get`](@ref) request is a dynamically allocated buffer
@@ -170,7 +255,10 @@ default).
     that the `freebuf` option is laways true.  This choice has been made
     because it would otherwise be difficult to warrant that data passed by a
     Julia send callback be not garbage collected before being fully transfered
-    to the client.
+    to the client.  To avoid copying large data, the send callback can call
+    [`XPA.store!`](@ref) with keyword `share=true`, then a specific free
+    function is installed for the request so that the data is kept alive
+    until sent.
 
 See also [`XPA.Server`](@ref), [`XPA.store!`](@ref) and
 [`XPA.ReceiveCallback`](@ref).
@@ -178,13 +266,17 @@ See also [`XPA.Server`](@ref), [`XPA.store!`](@ref) and
 """
 function SendCallback(func::F,
                       data::T = nothing;
-                      acl::Bool = true) where {T,F<:Function}
-    return SendCallback{T,F}(func, data, acl)
+                      acl::Bool = true,
+                      compress::Bool = true,
+                      cache::Integer = 0) where {T,F<:Function}
+    cache ≥ 0 || throw(ArgumentError("cache size must be nonnegative"))
+    return SendCallback{T,F}(func, data, acl, compress,
+                             (cache > 0 ? ResponseCache(cache) : nothing))
 end
 
 """
 ```julia
-ReceiveCallback(func, data=nothing; acl=true)
+ReceiveCallback(func, data=nothing; acl=true, stream=false)
 ```
 
 yields an instance of `ReceiveCallback` for processing the data sent by a call
@@ -204,14 +296,32 @@ default).
     otherwise be difficult to warrant that data passed to a Julia receive
     callback can be safely stealed by Julia.
 
+If keyword `stream` is true, the data are not read by XPA before calling the
+callback (as if `fillbuf` option is false) and the callback is called with an
+instance of [`XPA.ReceiveStream`](@ref) (instead of an
+[`XPA.ReceiveBuffer`](@ref)) to read the data from the data socket:
+
+```julia
+function rfunc(rdata, srv::XPA.Server, params::String, io::XPA.ReceiveStream)
+    open(filename, "w") do file
+        write(file, io)    # copy data to file by chunks
+    end
+    return XPA.SUCCESS
+end
+```
+
+This is useful to process large data with bounded memory, for instance by
+reading it with `read!(io, arr)` into a memory mapped array `arr`.
+
 Also see [`XPA.Server`](@ref), [`XPA.SendCallback`](@ref) and
 [`XPA.set`](@ref).
 
 """
 function ReceiveCallback(func::F,
                          data::T = nothing;
-                         acl::Bool = true) where {T,F<:Function}
-    return ReceiveCallback{T,F}(func, data, acl)
+                         acl::Bool = true,
+                         stream::Bool = false) where {T,F<:Function}
+    return ReceiveCallback{T,F}(func, data, acl, stream)
 end
 
 const _MINIMAL_SEND_MODE = MODE_FREEBUF
@@ -226,15 +336,61 @@ function _send(clientdata::Ptr{Cvoid}, handle::Ptr{Cvoid}, params::Ptr{Byte},
     (get_send_mode(srv) & _MINIMAL_SEND_MODE) == _MINIMAL_SEND_MODE ||
         return error(srv, "send mode must have option `freebuf=true`")
 
+    # Make sure no free hook left by a previous request on the same
+    # communication channel applies to the buffer of this request (the hook is
+    # only installed by `store!(...; share=true)`).
+    _set_free(handle, C_NULL, C_NULL)
+
     # Call actual callback providing the client data is the address of a known
     # SendCallback object.
-    return _send(unsafe_pointer_to_objref(clientdata), srv,
-                 (params == C_NULL ? "" : unsafe_string(params)),
-                 SendBuffer(bufptr, lenptr))
+    cb = unsafe_pointer_to_objref(clientdata)::SendCallback
+    opts, params = _request_options(params)
+    buf = SendBuffer(bufptr, lenptr, handle)
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    status = _send(cb, srv, (params == C_NULL ? "" : unsafe_string(params)),
+                   buf)
+    dt = (_instrumented() ? time_ns() - t0 : UInt64(0))
+    status == SUCCESS && opts != 0 && _encode!(buf, opts, cb.compress)
+    _instrumented() && _record_server!(srv, params, dt, status, 0,
+                                       unsafe_load(lenptr))
+    return status
+end
+
+# Apply the options negotiated by the client to the answer in `buf`.  Data
+# exported in shared memory are not compressed.
+function _encode!(buf::SendBuffer, opts::UInt, compress::Bool)
+    (opts & _OPTION_SHM) != 0 && _export_shared!(buf) && return nothing
+    compress && (opts & _OPTION_LZ4) != 0 && _compress!(buf)
+    return nothing
+end
+
+# Replace the contents of the send buffer by its compressed version (if
+# compressing is worth it).
+function _compress!(buf::SendBuffer)
+    ptr, len = unsafe_load(buf.bufptr), Int(unsafe_load(buf.lenptr))
+    zptr, zlen = _compress(ptr, len)
+    if zptr != NULL
+        _discard!(buf)
+        unsafe_store!(buf.bufptr, zptr)
+        unsafe_store!(buf.lenptr, zlen)
+    end
+    return nothing
+end
+
+# Replace the data of an `XPA.set` request by its decompressed version (if it
+# is compressed).
+function _decompress!(srv::Server, ptr::Ptr{Byte}, len::Integer)
+    _is_compressed(ptr, len) || return (ptr, Csize_t(len))
+    dptr, dlen = _decompress(ptr, len)
+    _set_comm_buf(srv, dptr)
+    _set_comm_len(srv, dlen)
+    _free(ptr)
+    return (dptr, Csize_t(dlen))
 end
 
 _send(cb::SendCallback, srv::Server, params::String, buf::SendBuffer) =
-    cb.send(cb.data, srv, params, buf)
+    (cb.cache === nothing ? cb.send(cb.data, srv, params, buf) :
+     _send_cached(cb, cb.cache, srv, params, buf))
 
 # The receive callback is executed in response to an external request from the
 # `xpaset` program, the `XPASet()` routine, or `XPASetFd()` routine.
@@ -242,25 +398,47 @@ function _recv(clientdata::Ptr{Cvoid}, handle::Ptr{Cvoid}, params::Ptr{Byte},
                buf::Ptr{Byte}, len::Csize_t)::Cint
     # Check assumptions.
     srv = Server(handle)
-    (get_recv_mode(srv) & _MINIMAL_RECEIVE_MODE) == _MINIMAL_RECEIVE_MODE ||
-        return error(srv, "receive mode must have options `buf=true`, `fillbuf=true` and `freebuf=true`")
+    cb = unsafe_pointer_to_objref(clientdata)::ReceiveCallback
+    if cb.stream
+        (get_recv_mode(srv) & _MINIMAL_RECEIVE_MODE) == MODE_BUF ||
+            return error(srv, "receive mode must have options `buf=true` and `fillbuf=false`")
+    else
+        (get_recv_mode(srv) & _MINIMAL_RECEIVE_MODE) == _MINIMAL_RECEIVE_MODE ||
+            return error(srv, "receive mode must have options `buf=true`, `fillbuf=true` and `freebuf=true`")
+    end
+
+    # Decompress data if needed.
+    opts, params = _request_options(params)
+    if (opts & _OPTION_LZ4) != 0
+        cb.stream && return error(srv, "compressed data cannot be streamed")
+        buf, len = _decompress!(srv, buf, len)
+    end
 
     # Call actual callback providing the client data is the address of a known
     # ReceiveCallback object.
-    return _recv(unsafe_pointer_to_objref(clientdata), srv,
-                 (params == C_NULL ? "" : unsafe_string(params)),
-                 ReceiveBuffer(buf, len))
+    t0 = (_instrumented() ? time_ns() : UInt64(0))
+    status = _recv(cb, srv, (params == C_NULL ? "" : unsafe_string(params)),
+                   (cb.stream ?
+                    ReceiveStream(get_comm_datafd(srv),
+                                  1000*_CONFIG[].long_timeout) :
+                    ReceiveBuffer(buf, len)))
+    _instrumented() && _record_server!(srv, params, time_ns() - t0, status,
+                                       (cb.stream ? 0 : len), 0)
+    return status
 end
 
-_recv(cb::ReceiveCallback, srv::Server, params::String, buf::ReceiveBuffer) =
+_recv(cb::ReceiveCallback, srv::Server, params::String,
+      buf::Union{ReceiveBuffer,ReceiveStream}) =
     cb.recv(cb.data, srv, params, buf)
 
 # Addresses of callbacks cannot be precompiled so we set them at run-time in
 # the __init__() method of the module.
 const _SEND_REF = Ref{Ptr{Cvoid}}(0)
 const _RECV_REF = Ref{Ptr{Cvoid}}(0)
+const _FREE_REF = Ref{Ptr{Cvoid}}(0)
 function __init__()
-    global _SEND_REF, _RECV_REF
+    global _SEND_REF, _RECV_REF, _FREE_REF
+    _CONFIG[] = _load_config()
     _SEND_REF[] = @cfunction(_send, Cint,
                              (Ptr{Cvoid},     # client_data
                               Ptr{Cvoid},     # call_data
@@ -273,6 +451,11 @@ function __init__()
                               Ptr{Byte},      # paramlist
                               Ptr{Byte},      # buf
                               Csize_t))       # len
+    _FREE_REF[] = @cfunction(_unpin, Cvoid, (Ptr{Cvoid},))
+    # Without the self-pipe, polling threads are not woken when servers are
+    # created or closed.
+    ccall(:pipe, Cint, (Ptr{Cint},), _WAKE_PIPE) == 0 || fill!(_WAKE_PIPE, -1)
+    atexit(cleanup_shared)
 end
 
 """
@@ -289,7 +472,7 @@ Also see: [`XPA.Server`](@ref), [`XPA.message`](@ref),
 
 """
 function Base.error(srv::Server, msg::AbstractString)
-    ccall((:XPAError, libxpa), Cint, (Server, Cstring),
+    ccall((:XPAError, libxpa), Cint, (Ptr{Cvoid}, Cstring),
           srv, msg) == SUCCESS ||
               error("XPAError failed for message \"$msg\"");
     return FAILURE
@@ -309,11 +492,11 @@ Also see: [`XPA.Server`](@ref), [`XPA.error`](@ref),
 
 """
 message(srv::Server, msg::AbstractString) =
-    ccall((:XPAMessage, libxpa), Cint, (Server, Cstring), srv, msg)
+    ccall((:XPAMessage, libxpa), Cint, (Ptr{Cvoid}, Cstring), srv, msg)
 
 """
 ```julia
-XPA.store!(buf, data)
+XPA.store!(buf, data; share=false, framed=false)
 ```
 
 or
@@ -325,6 +508,25 @@ XPA.store!(buf, ptr, len)
 store into the send buffer `buf` a dynamically allocated copy of the contents
 of `data` or of the `len` bytes at address `ptr`.
 
+If keyword `share` is true and `data` is a dense array (possibly memory
+mapped) or a string, no bytes are copied: the memory of `data` is directly
+handed to XPA and `data` is kept referenced (and thus protected from being
+garbage collected) until XPA has sent it to the client and calls the free hook
+installed by `store!`.  The contents of `data` must not be modified until
+then, which is at the end of the processing of the request by
+[`XPA.poll`](@ref) or [`XPA.mainloop`](@ref).  This is the recommended way to
+serve large arrays.  Other strings (and symbols) and arrays are first
+converted into a `String` or an `Array` which is then shared, so their bytes
+are copied once (by Julia instead of by `malloc`).
+
+If keyword `framed` is true and `data` is an array, the elements are preceded
+by a header describing their type, the dimensions of the array and the byte
+order of the server.  Such a self-describing array is retrieved by the client
+with `XPA.get(Array, ...)` (see [`XPA.get`](@ref)) without the need to know
+its type and dimensions in advance, the bytes being swapped if client and
+server have different byte orders.  The array may be non-contiguous (for
+instance a view), it is always copied.
+
 !!! warning
     This method is meant to be used in a *send* callback to store the result of
     an [`XPA.get`](@ref) request processed by an XPA server.  Memory leaks are
@@ -345,14 +547,10 @@ function store!(buf::SendBuffer, ptr::Ptr{Byte}, len::Integer)
     # This function is similar to `XPASetBuf` except that it makes a dynamic
     # copy of the data to send (because option `freebuf` is always true) and
     # destroys any buffer which could have been set before.
-    if (tmp = unsafe_load(buf.bufptr)) != NULL && unsafe_load(buf.lenptr) > 0
-        unsafe_store!(buf.lenptr, 0)
-        unsafe_store!(buf.bufptr, NULL)
-        _free(tmp)
-    end
+    _discard!(buf)
     if ptr != NULL
         len > 0 || error("invalid number of bytes ($len) for non-NULL pointer")
-        unsafe_store!(buf.bufptr, _memcpy(_malloc(len), ptr, len))
+        unsafe_store!(buf.bufptr, _memcpy!(_malloc(len), ptr, len))
         unsafe_store!(buf.lenptr, len)
     else
         len == 0 || error("invalid number of bytes ($len) for NULL pointer")
@@ -362,26 +560,39 @@ end
 
 store!(buf::SendBuffer, ::Nothing) = store!(buf, NULL, 0)
 
-store!(buf::SendBuffer, val::Union{Symbol,AbstractString}) =
-    store!(buf, String(val))
+store!(buf::SendBuffer, val::Union{Symbol,AbstractString}; kwds...) =
+    store!(buf, String(val); kwds...)
 
-store!(buf::SendBuffer, str::String) =
-    store!(buf.bufptr, buf.lenptr,
-           Base.unsafe_convert(Ptr{Byte}, str), sizeof(str))
+function store!(buf::SendBuffer, str::String; share::Bool = false)
+    share && return _share!(buf, str, Base.unsafe_convert(Ptr{Byte}, str),
+                            sizeof(str))
+    GC.@preserve str store!(buf, Base.unsafe_convert(Ptr{Byte}, str),
+                            sizeof(str))
+end
 
-function store!(buf::SendBuffer, arr::DenseArray{T,N}) where {T, N}
+function store!(buf::SendBuffer, arr::DenseArray{T,N};
+                share::Bool = false, framed::Bool = false) where {T, N}
     @assert isbitstype(T)
-    store!(buf.bufptr, buf.lenptr,
-           convert(Ptr{Byte}, pointer(arr)), sizeof(arr))
+    if framed
+        share && throw(ArgumentError("framed arrays cannot be shared"))
+        return _store_framed!(buf, arr)
+    end
+    share && return _share!(buf, arr, convert(Ptr{Byte}, pointer(arr)),
+                            sizeof(arr))
+    GC.@preserve arr store!(buf, convert(Ptr{Byte}, pointer(arr)),
+                            sizeof(arr))
+end
+
+function store!(buf::SendBuffer, arr::AbstractArray{T,N};
+                share::Bool = false, framed::Bool = false) where {T, N}
+    @assert isbitstype(T)
+    framed && return _store_framed!(buf, arr)
+    return store!(buf, collect(arr); share = share)
 end
 
 function store!(buf::SendBuffer, val::T) where {T}
     @assert isbitstype(T)
-    if (tmp = unsafe_load(buf.bufptr)) != NULL && unsafe_load(buf.lenptr) > 0
-        unsafe_store!(buf.lenptr, 0)
-        unsafe_store!(buf.bufptr, NULL)
-        _free(tmp)
-    end
+    _discard!(buf)
     len = sizeof(T)
     ptr = _malloc(len)
     unsafe_store!(convert(Ptr{T}, ptr), val)
@@ -390,6 +601,76 @@ function store!(buf::SendBuffer, val::T) where {T}
     return nothing
 end
 
+# Objects whose memory has been handed to XPA by `store!(...; share=true)` are
+# referenced here (with a count of the number of pending requests using them)
+# until XPA calls the free hook `_unpin` for their address.
+const _PINNED = Dict{Ptr{Byte},Tuple{Any,Int}}()
+const _PINNED_LOCK = ReentrantLock()
+
+function _share!(buf::SendBuffer, obj, ptr::Ptr{Byte}, len::Int)
+    _discard!(buf)
+    if ptr != NULL && len > 0
+        _pin(obj, ptr)
+        unsafe_store!(buf.bufptr, ptr)
+        unsafe_store!(buf.lenptr, len)
+        # XPA calls `myfree(myfree_ptr)`, so the address of the buffer is
+        # given as `myfree_ptr`.
+        _set_free(buf.xpa, _FREE_REF[], Ptr{Cvoid}(ptr)) == SUCCESS ||
+            (_discard!(buf); error("XPASetFree failed"))
+    end
+    return nothing
+end
+
+function _pin(obj, ptr::Ptr{Byte})
+    lock(_PINNED_LOCK)
+    try
+        cnt = (haskey(_PINNED, ptr) ? _PINNED[ptr][2] : 0)
+        _PINNED[ptr] = (obj, cnt + 1)
+    finally
+        unlock(_PINNED_LOCK)
+    end
+    return nothing
+end
+
+# Free hook installed by `_share!`.  Memory which has not been pinned is
+# assumed to have been allocated by `malloc` (which is the default for XPA).
+function _unpin(ptr::Ptr{Cvoid})
+    pinned = false
+    lock(_PINNED_LOCK)
+    try
+        key = Ptr{Byte}(ptr)
+        if haskey(_PINNED, key)
+            pinned = true
+            obj, cnt = _PINNED[key]
+            if cnt > 1
+                _PINNED[key] = (obj, cnt - 1)
+            else
+                delete!(_PINNED, key)
+            end
+        end
+    finally
+        unlock(_PINNED_LOCK)
+    end
+    pinned || _free(ptr)
+    return nothing
+end
+
+_set_free(xpa::Ptr{Cvoid}, func::Ptr{Cvoid}, data::Ptr{Cvoid}) =
+    (xpa == C_NULL ? FAILURE :
+     ccall((:XPASetFree, libxpa), Cint, (Ptr{Cvoid}, Ptr{Cvoid}, Ptr{Cvoid}),
+           xpa, func, data))
+
+# Destroy any buffer previously stored in `buf`.
+function _discard!(buf::SendBuffer)
+    if (ptr = unsafe_load(buf.bufptr)) != NULL
+        unsafe_store!(buf.lenptr, 0)
+        unsafe_store!(buf.bufptr, NULL)
+        _unpin(Ptr{Cvoid}(ptr))
+        _set_free(buf.xpa, C_NULL, C_NULL)
+    end
+    return nothing
+end
+
 function Base.copyto!(dst::AbstractArray{T,N},
                       buf::ReceiveBuffer) where {T,N}
     @assert isbitstype(T)
@@ -433,7 +714,7 @@ See also [`XPA.ReceiveCallback`](@ref).
                       i::Int=1)::T where {T}
     @assert isbitstype(T)
     @boundscheck checkbounds(T, buf, i)
-    return unsafe_load(Ptr{T}(pointer(buf)), j)
+    return unsafe_load(Ptr{T}(pointer(buf)), i)
 end
 
 @inline @propagate_inbounds function peek(::Type{T},
@@ -456,7 +737,7 @@ function peek(::Type{Vector{T}},
     else
         vec = Vector{T}(undef, len)
         nbytes = sizeof(T)*len
-        nbytes > 0 && _memcpy(pointer(vec), pointer(buf), nbytes)
+        nbytes > 0 && _memcpy!(pointer(vec), pointer(buf), nbytes)
     end
     return vec
 end
@@ -499,11 +780,108 @@ function peek(::Type{Array{T,N}},
         arr = unsafe_wrap(Array, Ptr{T}(pointer(buf)), dims)
     else
         arr = Array{T,N}(undef, dims)
-        nbytes > 0 && _memcpy(pointer(arr), pointer(buf), nbytes)
+        nbytes > 0 && _memcpy!(pointer(arr), pointer(buf), nbytes)
     end
     return arr
 end
 
+# Methods for reading the data of a set request from the data socket.  Reading
+# is blocking (other tasks must not be resumed while serving a request) with a
+# timeout.
+Base.isopen(io::ReceiveStream) = !io.eof || io.pos ≤ io.len
+Base.close(io::ReceiveStream) = nothing
+Base.isreadable(io::ReceiveStream) = true
+Base.iswritable(io::ReceiveStream) = false
+Base.bytesavailable(io::ReceiveStream) = io.len - io.pos + 1
+
+function Base.eof(io::ReceiveStream)
+    io.pos ≤ io.len && return false
+    io.eof && return true
+    return _fill!(io) == 0
+end
+
+function Base.read(io::ReceiveStream, ::Type{UInt8})
+    eof(io) && throw(EOFError())
+    b = io.buf[io.pos]
+    io.pos += 1
+    return b
+end
+
+function Base.unsafe_read(io::ReceiveStream, ptr::Ptr{UInt8}, nbytes::UInt)
+    n = Int(nbytes)
+    # Use buffered bytes first.
+    if (m = min(n, bytesavailable(io))) > 0
+        GC.@preserve io _memcpy!(ptr, pointer(io.buf, io.pos), m)
+        io.pos += m
+        ptr += m
+        n -= m
+    end
+    # Directly read remaining bytes.
+    while n > 0
+        io.eof && throw(EOFError())
+        m = _read(io, ptr, n)
+        ptr += m
+        n -= m
+    end
+    return nothing
+end
+
+function Base.readavailable(io::ReceiveStream)
+    eof(io) && return Byte[]
+    bytes = io.buf[io.pos:io.len]
+    io.pos = io.len + 1
+    return bytes
+end
+
+# Fill internal buffer, returning the number of available bytes.
+function _fill!(io::ReceiveStream)
+    io.pos = 1
+    io.len = 0
+    io.eof && return 0
+    io.len = GC.@preserve io _read(io, pointer(io.buf), length(io.buf))
+    return io.len
+end
+
+# Read at most `n` bytes from the data socket, set the end-of-file flag if no
+# more data.
+function _read(io::ReceiveStream, ptr::Ptr{UInt8}, n::Int)
+    while true
+        m = ccall(:read, Cssize_t, (Cint, Ptr{Cvoid}, Csize_t), io.fd, ptr, n)
+        if m > 0
+            return Int(m)
+        elseif m == 0
+            io.eof = true
+            return 0
+        end
+        errno = Libc.errno()
+        if errno == Libc.EAGAIN || errno == Libc.EWOULDBLOCK
+            _wait_readable(io.fd, io.timeout) ||
+                error("timeout while reading data sent by XPA client")
+        elseif errno != Libc.EINTR
+            throw(SystemError("reading data sent by XPA client", errno))
+        end
+    end
+end
+
+# Structure `struct pollfd` in `<poll.h>`.
+struct _PollFD
+    fd::Cint
+    events::Cshort
+    revents::Cshort
+end
+const _POLLIN = Cshort(1)
+
+# Wait (without yielding to other tasks) until a file descriptor is readable,
+# returning false in case of timeout.
+function _wait_readable(fd::Cint, timeout::Integer)
+    ref = Ref(_PollFD(fd, _POLLIN, 0))
+    while true
+        r = ccall(:poll, Cint, (Ptr{_PollFD}, Culong, Cint), ref, 1, timeout)
+        r ≥ 0 && return r > 0
+        Libc.errno() == Libc.EINTR || throw(SystemError("poll", Libc.errno()))
+    end
+end
+
 """
 ```julia
 XPA.poll(sec, maxreq)
@@ -515,7 +893,11 @@ which checks for and processes XPA requests without blocking.
 Argument `sec` specifies a timeout in seconds (rounded to millisecond
 precision).  If `sec` is positive, the method blocks no longer than this amount
 of time.  If `sec` is strictly negative, the routine blocks until the occurence
-of an event to be processed.
+of an event to be processed.  The calling thread is blocked while waiting
+(see [`XPA.watch`](@ref) to let other tasks run), but the lock serializing the
+calls to the XPA library is not held so that servers can be created or
+closed by other threads: this wakes the waiting thread which then also waits
+for the requests to the new servers.
 
 Argument `maxreq` specifies how many requests will be processed.  If `maxreq <
 0`, then no events are processed, but instead, the returned value indicates the
@@ -547,8 +929,9 @@ contents of the reference to `false`.
 
 Another possibility is to use [`XPA.mainloop`](@ref) (which to see).
 
-To let Julia performs other tasks, the polling method may be repeatedly called
-by a Julia timer.  The following example does this.  Calling `resume` starts
+To let Julia performs other tasks, the best is to call [`XPA.watch`](@ref)
+which processes requests as soon as they arrive.  Otherwise, the polling
+method may be repeatedly called by a Julia timer.  The following example does this.  Calling `resume` starts
 polling for XPA events immediately and then every 100ms.  Calling `suspend`
 suspends the processing of XPA events.
 
@@ -567,12 +950,330 @@ suspend() =
 ```
 
 
-Also see: [`XPA.Server`](@ref), [`XPA.mainloop`](@ref).
+Also see: [`XPA.Server`](@ref), [`XPA.mainloop`](@ref), [`XPA.watch`](@ref).
 
 """
 poll(sec::Real, maxreq::Integer) =
-    ccall((:XPAPoll, libxpa), Cint, (Cint, Cint),
-          (sec < 0 ? -1 : round(Cint, 1E3*sec)), maxreq)
+    _poll((sec < 0 ? -1 : round(Int, 1E3*sec)), Cint(maxreq), false)
+
+# Poll for XPA events during at most `msec` milliseconds (no limit if
+# negative).  `XPAPoll` is only called with a null timeout, with the lock
+# held, to process the pending events.  The sockets of the servers are waited
+# for, without the lock, together with the self-pipe `_WAKE_PIPE` written
+# when servers are created or closed.  If `wake` is true, 0 is returned when
+# woken by the self-pipe.
+function _poll(msec::Int, maxreq::Cint, wake::Bool)
+    t0 = time_ns()
+    pfds = _PollFD[]
+    fds = _SocketKey[]
+    while true
+        lock(_XPA_LOCK)
+        n = try
+            ccall((:XPAPoll, libxpa), Cint, (Cint, Cint), 0, maxreq)
+        finally
+            unlock(_XPA_LOCK)
+        end
+        (n != 0 || msec == 0) && return n
+        timeout = -1
+        if msec > 0
+            timeout = msec - Int(div(time_ns() - t0, 1_000_000))
+            timeout > 0 || return n
+        end
+        _wait_sockets!(pfds, fds, timeout) && wake && return n
+    end
+end
+
+# Self-pipe waking the threads waiting in `_poll`, created by `__init__`.
+# Bytes are only written while threads are waiting (they are counted by
+# `_POLLERS`), so that the pipe never fills.
+const _WAKE_PIPE = Cint[-1, -1]
+const _POLLERS = Threads.Atomic{Int}(0)
+
+function _wake_pollers()
+    if _POLLERS[] > 0 && _WAKE_PIPE[2] ≥ 0
+        ccall(:write, Cssize_t, (Cint, Ptr{Cvoid}, Csize_t),
+              _WAKE_PIPE[2], Ref(0x00), 1)
+    end
+    return nothing
+end
+
+# Wait until a socket of the servers is readable, the self-pipe is written or
+# `timeout` milliseconds (if nonnegative) have elapsed.  Yield whether woken
+# by the self-pipe.
+function _wait_sockets!(pfds::Vector{_PollFD},
+                        fds::Vector{_SocketKey}, timeout::Int)
+    Threads.atomic_add!(_POLLERS, 1)
+    try
+        # The sockets are collected after having been counted as a waiting
+        # thread, so that servers created meanwhile wake the thread.
+        empty!(fds)
+        lock(_XPA_LOCK)
+        try
+            for ptr in keys(_SERVERS)
+                _collect_fds!(fds, ptr)
+            end
+        finally
+            unlock(_XPA_LOCK)
+        end
+        empty!(pfds)
+        push!(pfds, _PollFD(_WAKE_PIPE[1], _POLLIN, 0))
+        for (fd, _, _) in fds
+            push!(pfds, _PollFD(fd, _POLLIN, 0))
+        end
+        while true
+            r = ccall(:poll, Cint, (Ptr{_PollFD}, Culong, Cint),
+                      pfds, length(pfds), timeout)
+            r ≥ 0 && break
+            Libc.errno() == Libc.EINTR ||
+                throw(SystemError("poll", Libc.errno()))
+        end
+        pfds[1].revents == 0 && return false
+        buf = Ref{NTuple{64,UInt8}}()
+        ccall(:read, Cssize_t, (Cint, Ptr{Cvoid}, Csize_t),
+              _WAKE_PIPE[1], buf, sizeof(buf))
+        return true
+    finally
+        Threads.atomic_sub!(_POLLERS, 1)
+    end
+end
+
+# Process at most `maxreq` pending requests on socket `fd` (or all pending
+# requests if `maxreq == 0`) with `XPAProcessSelect` which, unlike `XPAPoll`,
+# does not block and only considers the sockets set in the given `fd_set`.
+function _process(fd::Cint, maxreq::Integer)
+    0 ≤ fd < _FD_SETSIZE || return poll(0, maxreq)
+    nbits = 8*sizeof(Culong)
+    lock(_XPA_LOCK)
+    try
+        fill!(_FDSET, 0)
+        _FDSET[div(fd, nbits) + 1] = one(Culong) << rem(fd, nbits)
+        return ccall((:XPAProcessSelect, libxpa), Cint, (Ptr{Culong}, Cint),
+                     _FDSET, maxreq)
+    finally
+        unlock(_XPA_LOCK)
+    end
+end
+
+# Storage for a `fd_set` structure (an array of bits indexed by the file
+# descriptors), only used with `_XPA_LOCK` held.
+const _FD_SETSIZE = 1024
+const _FDSET = zeros(Culong, div(_FD_SETSIZE, 8*sizeof(Culong)))
+
+"""
+```julia
+XPA.watch() -> w
+```
+
+starts processing the requests sent to the XPA server(s) created by this
+process in the background and returns an instance of [`XPA.Watcher`](@ref).
+Call `close(w)` to stop processing the requests.
+
+The listening and communication sockets of the servers are watched by Julia
+event loop (see `FileWatching`) and [`XPA.poll`](@ref) is only called when
+some of these sockets have pending data.  Compared to calling
+[`XPA.poll`](@ref) by a timer, requests are processed without delays and no
+CPU is consumed while there are no requests.  Servers created or closed after
+the watcher has been started are automatically taken into account.
+
+The watcher runs as tasks which are sticky to the calling thread, the
+callbacks of the servers are therefore called by this thread.  Only one
+watcher should be running and [`XPA.poll`](@ref) or [`XPA.mainloop`](@ref)
+should not be called meanwhile.  Each socket with pending data is processed
+in turn, one request at a time, so that a burst of requests to one server
+does not delay the requests to the other servers of the process.  For
+example:
+
+```julia
+srv = XPA.Server(...)
+w = XPA.watch()
+... # do other things while requests are processed
+close(w)
+```
+
+Also see: [`XPA.Server`](@ref), [`XPA.poll`](@ref).
+
+"""
+function watch()
+    w = Watcher()
+    lock(_WATCHERS_LOCK)
+    try
+        push!(_WATCHERS, w)
+    finally
+        unlock(_WATCHERS_LOCK)
+    end
+    w.task = @async _control_loop(w)
+    return w
+end
+
+const _WATCHERS = Watcher[]
+const _WATCHERS_LOCK = ReentrantLock()
+
+Base.isopen(w::Watcher) = w.open
+
+function Base.close(w::Watcher)
+    if w.open
+        lock(w.cond)
+        try
+            w.open = false
+            notify(w.cond)
+        finally
+            unlock(w.cond)
+        end
+        lock(_WATCHERS_LOCK)
+        try
+            filter!(x -> x !== w, _WATCHERS)
+        finally
+            unlock(_WATCHERS_LOCK)
+        end
+    end
+    return nothing
+end
+
+# Notify running watchers and polling threads that the set of sockets to
+# watch has changed.
+function _notify_watchers()
+    _wake_pollers()
+    lock(_WATCHERS_LOCK)
+    try
+        for w in _WATCHERS
+            _notify(w)
+        end
+    finally
+        unlock(_WATCHERS_LOCK)
+    end
+end
+
+function _notify(w::Watcher)
+    lock(w.cond)
+    try
+        w.pending = true
+        notify(w.cond)
+    finally
+        unlock(w.cond)
+    end
+end
+
+# The control loop updates the set of watched sockets when notified.
+function _control_loop(w::Watcher)
+    try
+        while true
+            lock(w.cond)
+            try
+                while w.open && !w.pending
+                    wait(w.cond)
+                end
+                w.pending = false
+            finally
+                unlock(w.cond)
+            end
+            w.open || break
+            _update!(w)
+        end
+    finally
+        for fdw in values(w.fds)
+            close(fdw)
+        end
+        empty!(w.fds)
+    end
+end
+
+# Update the sockets watched by `w`: stop watching closed sockets and start a
+# task for each new socket.  Sockets are identified by their file descriptor
+# and the address of the XPA structure owning them, so that a watcher is
+# recreated when a file descriptor is reused by a new communication record.
+# This scans all the servers and is only done when servers are created or
+# closed, see `_watch_loop` for the sockets opened or closed by requests.
+function _update!(w::Watcher)
+    fds = _SocketKey[]
+    lock(_XPA_LOCK)
+    try
+        for ptr in keys(_SERVERS)
+            _collect_fds!(fds, ptr)
+        end
+    finally
+        unlock(_XPA_LOCK)
+    end
+    for key in collect(keys(w.fds))
+        key in fds || close(pop!(w.fds, key))
+    end
+    _watch!(w, fds)
+    return nothing
+end
+
+# Update the sockets of a single XPA server watched by `w`, given the sockets
+# `before` and `after` of this server before and after processing a request.
+function _update!(w::Watcher, before::Vector{_SocketKey},
+                  after::Vector{_SocketKey})
+    for key in before
+        if !(key in after)
+            fdw = pop!(w.fds, key, nothing)
+            fdw === nothing || close(fdw)
+        end
+    end
+    _watch!(w, after)
+    return nothing
+end
+
+# Start a task for each socket in `fds` not yet watched by `w`.
+function _watch!(w::Watcher, fds::Vector{_SocketKey})
+    for key in fds
+        if w.open && !haskey(w.fds, key)
+            fdw = FDWatcher(RawFD(key[1]), true, false)
+            w.fds[key] = fdw
+            @async _watch_loop(w, key, fdw)
+        end
+    end
+    return nothing
+end
+
+# Store the listening and communication sockets of XPA server at `xpa` with
+# the address of their owner and of the server.
+function _collect_fds!(fds::Vector{_SocketKey}, xpa::Ptr{Cvoid})
+    fd = _get_field(Cint, xpa, _XPA_FD_OFFSET, Cint(-1))
+    fd ≥ 0 && push!(fds, (fd, xpa, xpa))
+    comm = _get_field(Ptr{Cvoid}, xpa, _XPA_COMMHEAD_OFFSET, C_NULL)
+    while comm != C_NULL
+        cmdfd = _get_field(Cint, comm, _COMM_CMDFD_OFFSET, Cint(-1))
+        cmdfd ≥ 0 && push!(fds, (cmdfd, comm, xpa))
+        datafd = _get_field(Cint, comm, _COMM_DATAFD_OFFSET, Cint(-1))
+        datafd ≥ 0 && datafd != cmdfd && push!(fds, (datafd, comm, xpa))
+        comm = _get_field(Ptr{Cvoid}, comm, _COMM_NEXT_OFFSET, C_NULL)
+    end
+    return fds
+end
+
+# Wait for data on a socket and process pending requests.  The sockets of the
+# server owning the socket are collected before and after processing, with
+# the lock held, and the watched sockets are only updated if a request has
+# opened or closed a communication socket.  Only the sockets of this server
+# are scanned; a closed server is left to the control loop.
+function _watch_loop(w::Watcher, key::_SocketKey, fdw::FDWatcher)
+    fd, xpa = key[1], key[3]
+    before, after = _SocketKey[], _SocketKey[]
+    try
+        while w.open && Base.get(w.fds, key, nothing) === fdw
+            wait(fdw)
+            (w.open && Base.get(w.fds, key, nothing) === fdw) || break
+            lock(_XPA_LOCK)
+            try
+                haskey(_SERVERS, xpa) || break
+                _collect_fds!(empty!(before), xpa)
+                _process(fd, 1)
+                empty!(after)
+                haskey(_SERVERS, xpa) && _collect_fds!(after, xpa)
+            finally
+                unlock(_XPA_LOCK)
+            end
+            after == before || _update!(w, before, after)
+        end
+    catch err
+        # Waiting on a closed watcher throws an exception, other errors are
+        # reported.
+        w.open && Base.get(w.fds, key, nothing) === fdw &&
+            @error "error while watching XPA socket" fd exception=err
+    end
+    return nothing
+end
 
 """
 ```julia
@@ -581,7 +1282,8 @@ XPA.mainloop()
 
 runs XPA event loop which handles the requests sent to the server(s) created by
 this process.  The loop runs until all servers created by this process have
-been closed.
+been closed.  As for [`XPA.poll`](@ref), servers may be created or closed by
+other threads while the loop is running.
 
 In the following example, the receive callback function close the server when
 it receives a `"quit"` command:
@@ -602,5 +1304,22 @@ end
 Also see: [`XPA.Server`](@ref), [`XPA.mainloop`](@ref).
 
 """
-mainloop() =
-    ccall((:XPAMainLoop, libxpa), Cint, ())
+function mainloop()
+    # `XPAMainLoop` would hold the lock until all servers are closed, the
+    # loop is therefore implemented by polling, woken when servers are
+    # created or closed.
+    cnt = 0
+    while _has_servers()
+        cnt += _poll(-1, Cint(0), true)
+    end
+    return Cint(cnt)
+end
+
+function _has_servers()
+    lock(_XPA_LOCK)
+    try
+        return !isempty(_SERVERS)
+    finally
+        unlock(_XPA_LOCK)
+    end
+end
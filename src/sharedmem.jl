@@ -0,0 +1,232 @@
+#
+# sharedmem.jl --
+#
+# Implement the transfer of the answers of XPA servers through shared memory
+# for clients running on the same host.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+# When a client asks for it (with the option "shm", see `_request_options`),
+# a server writes a large answer in a file of a memory based file system and
+# only sends a descriptor of the file:
+#
+#     bytes 1-4    magic "XPAM"
+#     bytes 5-12   number of bytes of the data (UInt64, little endian)
+#     bytes 13-    path of the file (not null terminated)
+#
+# The client maps the file in memory and deletes it (the mapping remains
+# valid until unmapped).  The mapped memory is owned by a Julia vector stored
+# in the `maps` field of the reply.  A reply of a request asking for shared
+# memory which is released with descriptors which have not been mapped deletes
+# their files.  The files which have not been
+# deleted by a client (for instance running on another host) are deleted by
+# the server after `_SHM_MAXAGE` seconds, see `XPA.cleanup_shared`.
+const _SHM_MAGIC = (0x58, 0x50, 0x41, 0x4d) # "XPAM"
+const _SHM_HEADER = 12
+const _SHM_MINSIZE = 1 << 16 # smaller data are sent through the socket
+const _SHM_PREFIX = "xpa-"
+const _SHM_MAXAGE = 60.0
+
+# Files exported by this process with their creation times, in chronological
+# order.
+const _EXPORTED = Tuple{Float64,String}[]
+const _EXPORTED_LOCK = Threads.SpinLock()
+
+# Empty vector meaning that a data buffer is not memory mapped, it must never
+# be modified.
+const _NOMAP = Byte[]
+
+_shm_dir() = (isdir("/dev/shm") ? "/dev/shm" : _CONFIG[].tmpdir)
+
+# Replace the contents of the send buffer by a descriptor of a file with the
+# same contents.  Yield whether this has been done, if not (the data is too
+# small or the file cannot be written) the answer is left unchanged.
+function _export_shared!(buf::SendBuffer)
+    ptr, len = unsafe_load(buf.bufptr), Int(unsafe_load(buf.lenptr))
+    (ptr == NULL || len < _SHM_MINSIZE) && return false
+    path = ""
+    try
+        dir = _shm_dir()
+        isdir(dir) || mkpath(dir; mode = 0o700)
+        # The file created by `mktemp` is only readable by the owner.
+        path, io = mktemp(dir; cleanup = false)
+        try
+            unsafe_write(io, ptr, len) == len || error("short write")
+        finally
+            close(io)
+        end
+        # Rename so that the client can check the origin of the file.
+        dst = joinpath(dir, _SHM_PREFIX*basename(path))
+        mv(path, dst)
+        path = dst
+    catch
+        isempty(path) || rm(path; force = true)
+        return false
+    end
+    cleanup_shared(_SHM_MAXAGE)
+    lock(_EXPORTED_LOCK)
+    try
+        push!(_EXPORTED, (time(), path))
+    finally
+        unlock(_EXPORTED_LOCK)
+    end
+    n = sizeof(path)
+    desc = _malloc(_SHM_HEADER + n)
+    for i in 1:4
+        unsafe_store!(desc, _SHM_MAGIC[i], i)
+    end
+    _store_le(desc + 4, UInt64(len))
+    GC.@preserve path _memcpy!(desc + _SHM_HEADER,
+                               Base.unsafe_convert(Ptr{Byte}, path), n)
+    _discard!(buf)
+    unsafe_store!(buf.bufptr, desc)
+    unsafe_store!(buf.lenptr, _SHM_HEADER + n)
+    return true
+end
+
+_is_shared(ptr::Ptr{Byte}, len::Integer) =
+    (ptr != NULL && len > _SHM_HEADER &&
+     unsafe_load(ptr, 1) == _SHM_MAGIC[1] &&
+     unsafe_load(ptr, 2) == _SHM_MAGIC[2] &&
+     unsafe_load(ptr, 3) == _SHM_MAGIC[3] &&
+     unsafe_load(ptr, 4) == _SHM_MAGIC[4])
+
+# Replace the data buffers of a reply which are descriptors of shared files
+# by the memory mapped contents of the files.
+function _map_shared!(rep::Reply)
+    for i in 1:length(rep)
+        ptr, len = rep.buffers[i], Int(rep.lengths[i])
+        _is_shared(ptr, len) || continue
+        local m::Vector{Byte}
+        try
+            m = _map_file(Int(_load_le(UInt64, ptr + 4)),
+                          unsafe_string(ptr + _SHM_HEADER, len - _SHM_HEADER))
+        catch
+            release!(rep)
+            rethrow()
+        end
+        _free(ptr)
+        rep.buffers[i] = pointer(m)
+        rep.lengths[i] = length(m)
+        rep.maps[i] = m
+    end
+    return rep
+end
+
+function _map_file(len::Int, path::String)
+    # Only files created by `_export_shared!` are accepted (the client deletes
+    # the file).
+    _is_shared_file(path) || error("invalid shared memory file \"$path\"")
+    try
+        # The file is opened for writing so that the mapped data can be
+        # modified (e.g. to swap bytes), this does not affect the server.
+        return open(path, "r+") do io
+            filesize(io) ≥ len || error("truncated shared memory file")
+            Mmap.mmap(io, Vector{Byte}, len)
+        end
+    finally
+        rm(path; force = true)
+    end
+end
+
+_is_shared_file(path::AbstractString) =
+    (dirname(path) == _shm_dir() && startswith(basename(path), _SHM_PREFIX))
+
+# Delete the file of the data buffer at `ptr` if it is the descriptor of a
+# shared file which has not been mapped.
+function _unlink_shared(ptr::Ptr{Byte}, len::Integer)
+    _is_shared(ptr, len) || return nothing
+    path = unsafe_string(ptr + _SHM_HEADER, len - _SHM_HEADER)
+    if _is_shared_file(path)
+        try
+            rm(path; force = true)
+        catch
+            # The file may belong to another user.
+            nothing
+        end
+    end
+    return nothing
+end
+
+"""
+```julia
+XPA.cleanup_shared(age=0) -> n
+```
+
+deletes the files written by the servers of this process to transfer their
+answers through shared memory (see keyword `shm` of [`XPA.get`](@ref)) which
+have been created more than `age` seconds ago.  The result is the number of
+files which had not yet been deleted.
+
+A client deletes the file as soon as it has mapped it in memory, or when it
+releases an answer which has not been mapped, but it cannot delete a file
+when it runs on another host or as another user.  The servers call
+`XPA.cleanup_shared(60)` whenever they write a new file and
+`XPA.cleanup_shared()` is called when the process exits.
+
+"""
+function cleanup_shared(age::Real = 0)
+    t = time() - age
+    old = String[]
+    lock(_EXPORTED_LOCK)
+    try
+        k = 0
+        while k < length(_EXPORTED) && _EXPORTED[k + 1][1] ≤ t
+            k += 1
+            push!(old, _EXPORTED[k][2])
+        end
+        k > 0 && deleteat!(_EXPORTED, 1:k)
+    finally
+        unlock(_EXPORTED_LOCK)
+    end
+    n = 0
+    for path in old
+        ispath(path) || continue
+        try
+            rm(path)
+            n += 1
+        catch
+            nothing
+        end
+    end
+    return n
+end
+
+# Yield the memory mapped data buffer of the `i`-th answer in `rep`, or
+# `nothing`.
+_mapping(rep::Reply, i::Integer) =
+    (1 ≤ i ≤ length(rep) && rep.maps[i] !== _NOMAP &&
+     rep.buffers[i] == pointer(rep.maps[i]) ? rep.maps[i] : nothing)
+
+# Detach the memory mapped data buffer of the `i`-th answer from `rep`.
+function _take_mapping!(rep::Reply, i::Integer)
+    m = rep.maps[i]
+    rep.maps[i] = _NOMAP
+    rep.buffers[i] = NULL
+    rep.lengths[i] = 0
+    return m
+end
+
+# Make a dynamically allocated copy of the memory mapped data buffer of the
+# `i`-th answer in `rep` and yield its address.
+function _unmap!(rep::Reply, i::Integer)
+    m = rep.maps[i]
+    rep.maps[i] = _NOMAP
+    ptr = rep.buffers[i]
+    ptr == pointer(m) || return ptr
+    len = length(m)
+    return (len > 0 ? _memcpy!(_malloc(len), ptr, len) : NULL)
+end
+
+# Wrap the memory mapped data `m` (starting at `offset` bytes) into an array.
+# The array keeps a reference on `m` (in its finalizer), so the memory is only
+# unmapped when both are garbage collected.
+function _wrap_mapping(::Type{Array{T,N}}, m::Vector{Byte},
+                       dims::NTuple{N,Int}, offset::Int = 0) where {T,N}
+    arr = unsafe_wrap(Array, Ptr{T}(pointer(m) + offset), dims, own = false)
+    return finalizer(_ -> m, arr)
+end
@@ -42,6 +42,22 @@ abstract type Handle end
 # handle has been closed (or not yet open).
 Base.isopen(conn::Handle) = conn.ptr != C_NULL
 
+# Handles are passed to C functions as the address of their XPA structure.
+Base.unsafe_convert(::Type{Ptr{Cvoid}}, conn::Handle) = conn.ptr
+
+"""
+
+An instance of the mutable structure `XPA.Health` records the health of an
+XPA access point as seen by the clients of the process, see
+[`XPA.health`](@ref).
+
+"""
+mutable struct Health
+    last_success::Float64 # time of the last successful request (0 if none)
+    failures::Int         # number of consecutive failed requests
+    retry_at::Float64     # time before which requests fail fast
+end
+
 """
 
 An instance of the mutable structure `XPA.Client` represents a client
@@ -51,7 +67,25 @@ connection in the XPA Messaging System.
 mutable struct Client <: Handle # must be mutable to be finalized
     ptr::Ptr{Cvoid} # pointer to XPARec structure
     # finalizer can be safely called with a NULL pointer
-    Client(ptr::Ptr) = finalizer(close, new(ptr))
+    Client(ptr::Ptr) = finalizer(_finalize, new(ptr))
+end
+
+"""
+
+An instance of the mutable structure `XPA.ConnectionPool` is a task-safe pool
+of persistent client connections.  Connections are taken from the pool by
+`XPA.acquire!(pool)` and given back by `XPA.release!(pool, conn)`.  At most
+`pool.maxsize` idle connections are kept open in the pool.
+
+See also [`XPA.getmany`](@ref) and [`XPA.setmany`](@ref).
+
+"""
+mutable struct ConnectionPool
+    lock::Threads.SpinLock
+    free::Vector{Client} # idle connections
+    maxsize::Int         # maximum number of idle connections
+    ConnectionPool(maxsize::Integer = 64) =
+        new(Threads.SpinLock(), Client[], maxsize)
 end
 
 """
@@ -68,19 +102,47 @@ const TupleOf{T} = Tuple{Vararg{T}}
 [`XPA.set`](@ref) requests.  Method `length` applied to an object of type
 `Reply` yields the number of replies.  Methods [`XPA.get_data`](@ref),
 [`XPA.get_server`](@ref) and [`XPA.get_message`](@ref) can be used to retrieve
-the contents of an object of type `XPA.Reply`.
+the contents of an object of type `XPA.Reply`.  Iterating over an object of
+type `Reply` yields its answers as instances of [`XPA.Answer`](@ref) and
+[`XPA.classify`](@ref) sorts the answers according to their status.
 
 """
 mutable struct Reply
     replies::Int
     lengths::Vector{Csize_t}
     buffers::Vector{Ptr{Byte}}
+    maps::Vector{Vector{Byte}} # memory mapped data buffers (see `_map_shared!`)
+    shared::Bool # whether answers through shared memory have been requested
 end
 
 Base.length(rep::Reply) = rep.replies
 
 """
 
+An instance of the structure `XPA.Request` represents an asynchronous client
+request started by [`XPA.get_async`](@ref) or [`XPA.set_async`](@ref).
+
+"""
+struct Request
+    task::Task                       # task running the request
+    cancelled::Threads.Atomic{Bool}  # whether the request has been cancelled
+end
+
+"""
+
+An instance of the structure `XPA.Batch` collects the commands to be sent by
+[`XPA.batch`](@ref) to an XPA access point.
+
+"""
+struct Batch
+    conn::Client           # client connection
+    apt::String            # target access point
+    params::Vector{String} # parameter lists of the commands
+    data::Vector{Any}      # data of the commands (see `XPA.buffer`)
+end
+
+"""
+
 An instance of the mutable structure `XPA.Server` represents a server
 connection in the XPA Messaging System.
 
@@ -89,8 +151,62 @@ mutable struct Server <: Handle # must be mutable to be finalized
     ptr::Ptr{Cvoid} # pointer to XPARec structure
 end
 
+"""
+
+An instance of the mutable structure `XPA.Watcher` represents a task
+processing the requests sent to the XPA servers of the process as soon as
+their sockets have pending data.  See [`XPA.watch`](@ref).
+
+"""
+# Key identifying a socket of an XPA server: its file descriptor, the address
+# of the structure (XPA server or communication record) owning it and the
+# address of the XPA server.
+const _SocketKey = Tuple{Cint,Ptr{Cvoid},Ptr{Cvoid}}
+
+mutable struct Watcher
+    open::Bool
+    fds::Dict{_SocketKey,FDWatcher} # watched sockets
+    cond::Threads.Condition    # to notify changes of the set of servers
+    pending::Bool              # whether the watched sockets must be updated
+    task::Task                 # task controlling the watcher
+    Watcher() = new(true, Dict{_SocketKey,FDWatcher}(),
+                    Threads.Condition(), true)
+end
+
 abstract type Callback end
 
+mutable struct CachedAnswer
+    data::Vector{Byte} # bytes of the answer, never modified
+    used::UInt64       # value of the clock of the cache when last used
+end
+
+"""
+
+An instance of the mutable structure `XPA.ResponseCache` memorizes the answers
+of a send callback indexed by their parameter list, see keyword `cache` of
+[`XPA.SendCallback`](@ref).  The least recently used answers are evicted when
+the total size of the cache (the sizes of the answers and of their parameter
+lists) exceeds `cache.maxbytes` bytes.  Fields `cache.hits`, `cache.misses`
+and `cache.evictions` count the number of requests served from the cache,
+the number of requests served by calling the send function and the number of
+evicted answers.  The cache of a server is given by
+[`XPA.responsecache(srv)`](@ref XPA.responsecache).
+
+"""
+mutable struct ResponseCache
+    lock::Threads.SpinLock
+    entries::Dict{String,CachedAnswer}
+    maxbytes::Int   # maximum size of the cache
+    bytes::Int      # current size of the cache
+    clock::UInt64   # incremented by each look-up
+    hits::Int       # number of requests served from the cache
+    misses::Int     # number of requests served by the send function
+    evictions::Int  # number of evicted answers
+    ResponseCache(maxbytes::Integer) =
+        new(Threads.SpinLock(), Dict{String,CachedAnswer}(), maxbytes, 0,
+            0, 0, 0, 0)
+end
+
 """
 
 An instance of the `XPA.SendCallback` structure represents a callback called to
@@ -102,6 +218,22 @@ mutable struct SendCallback{T,F<:Function} <: Callback
     send::F        # function to call on `XPA.get` requests
     data::T        # client data
     acl::Bool      # enable access control
+    compress::Bool # compress answers if requested by the client
+    cache::Union{ResponseCache,Nothing} # cache of answers if any
+end
+
+"""
+```julia
+XPA.Published(data=nothing)
+```
+
+yields a value to be published by an XPA server, see [`XPA.publish!`](@ref).
+
+"""
+mutable struct Published
+    buffer::Vector{Byte} # version header followed by the payload, never modified
+    version::Int
+    Published() = new(_published_buffer(NULL, 0, 0), 0)
 end
 
 """
@@ -118,6 +250,7 @@ and [`XPA.SendCallback`](@ref).
 struct SendBuffer
     bufptr::Ptr{Ptr{Byte}}
     lenptr::Ptr{Csize_t}
+    xpa::Ptr{Cvoid} # XPA server serving the request (for `XPASetFree`)
 end
 
 """
@@ -131,6 +264,28 @@ mutable struct ReceiveCallback{T,F<:Function} <: Callback
     recv::F        # function to call on `XPA.set` requests
     data::T        # client data
     acl::Bool      # enable access control
+    stream::Bool   # data is read from the data socket by the callback
+end
+
+"""
+
+An instance of the mutable structure `XPA.WorkQueue` wraps the function of a
+receive callback so that received data are processed by a pool of worker
+tasks instead of by the thread polling for XPA requests.  See
+[`XPA.WorkQueue`](@ref) constructor.
+
+"""
+mutable struct WorkQueue{F<:Function} <: Function
+    func::F                        # function to process received data
+    ack::Symbol                    # when to acknowledge the client
+    capacity::Int                  # maximum number of pending jobs
+    jobs::Vector{Any}              # pending jobs
+    cond::Threads.Condition        # to notify workers
+    open::Bool                     # whether the queue accepts new jobs
+    workers::Vector{Task}          # worker tasks
+    processed::Threads.Atomic{Int} # number of successfully processed jobs
+    failed::Threads.Atomic{Int}    # number of failed jobs
+    dropped::Threads.Atomic{Int}   # number of jobs dropped because queue full
 end
 
 """
@@ -158,6 +313,84 @@ Base.pointer(buf::ReceiveBuffer) = buf.ptr
 
 """
 
+An instance of the `XPA.ReceiveStream` structure is provided to receive
+callbacks created with option `stream=true` to read the data sent by an
+[`XPA.set`](@ref) request directly from the data socket.  It is a Julia `IO`
+object which can only be read, see [`XPA.ReceiveCallback`](@ref).
+
+"""
+mutable struct ReceiveStream <: IO
+    fd::Cint             # data socket
+    buf::Vector{Byte}    # internal buffer
+    pos::Int             # index of next byte to read in buffer
+    len::Int             # number of bytes in buffer
+    eof::Bool            # whether end of data has been reached
+    timeout::Int         # timeout in milliseconds
+    ReceiveStream(fd::Integer, timeout::Integer) =
+        new(fd, Vector{Byte}(undef, 65536), 1, 0, fd < 0, timeout)
+end
+
+"""
+
+An instance of the `XPA.StringView` structure is a read-only string whose
+characters are stored in memory not owned by Julia (for instance the
+parameter list of an XPA request).  Creating such a view does not copy nor
+allocate anything but the view is only valid as long as the memory it refers
+to is left unchanged: when given to a callback, it must not be used after the
+callback has returned (call `String(str)` to make a copy).
+
+"""
+struct StringView <: AbstractString
+    ptr::Ptr{Byte} # address of first byte
+    len::Int       # number of bytes
+end
+
+"""
+
+An instance of the mutable structure `XPA.Commands` stores a table of named
+sub-commands served by an XPA server, see [`XPA.Commands`](@ref) constructor.
+
+"""
+mutable struct Commands{T,S<:Tuple,R<:Tuple}
+    # must be mutable because pointer_from_objref is used to recover it
+    data::T                  # client data
+    verbs::Vector{String}    # names of the commands
+    help::Vector{String}     # help for each command
+    send::S                  # send handlers (`nothing` if none)
+    recv::R                  # receive handlers (`nothing` if none)
+    index::Dict{UInt64,Int}  # hash of command name -> index
+    server::Server           # non-owning handle of last server
+    acl::Bool                # enable access control
+    compress::Bool           # compress answers if requested by the client
+end
+
+"""
+
+An instance of the `XPA.Answer` structure represents the `i`-th answer in an
+[`XPA.Reply`](@ref) as obtained by iterating over the reply or by `rep[i]`.
+Its fields are:
+
+- `index`: the index `i` of the answer in the reply;
+- `server`: the identifier of the server (`CLASS:NAME ADDRESS`);
+- `message`: the message (possibly empty or starting with `XPA\$ERROR` or
+  `XPA\$MESSAGE`) of the answer;
+- `data`: the data bytes of the answer.
+
+All these fields are instances of [`XPA.StringView`](@ref) which directly
+refer to the buffers of the reply, so building an answer does not copy nor
+allocate anything, but an answer is only valid while the reply is not
+released nor its data extracted by [`XPA.get_data`](@ref).
+
+"""
+struct Answer
+    index::Int
+    server::StringView
+    message::StringView
+    data::StringView
+end
+
+"""
+
 An instance of the `XPA.AccessPoint` structure represents an available XPA
 server.  A vector of such instances is returned by the [`XPA.list`](@ref)
 utility.
@@ -172,6 +405,59 @@ struct AccessPoint
     access::UInt  # allowed access
 end
 
+"""
+
+An instance of the mutable structure `XPA.Target` is an XPA access point
+bound to a client connection by [`XPA.bind`](@ref).
+
+"""
+mutable struct Target
+    conn::Client      # client connection
+    ident::String     # `CLASS:NAME` identifier
+    user::String      # owner of the access point
+    mode::String      # default mode of requests
+    apt::AccessPoint  # resolved access point
+end
+
+# Index of a list of access points.  Dictionaries `pairs` and `names` give the
+# first access point with a given `(class, name)` and with a given name, `next`
+# gives for each access point the next ones with the same `(class, name)` and
+# with the same name (0 if none).
+struct NameIndex
+    pairs::Dict{NTuple{2,String},Int}
+    names::Dict{String,Int}
+    next::Vector{NTuple{2,Int}}
+    NameIndex() = new(Dict{NTuple{2,String},Int}(), Dict{String,Int}(),
+                      NTuple{2,Int}[])
+end
+
+"""
+
+An instance of the mutable structure `XPA.NameCache` memorizes the access
+points found by [`XPA.find`](@ref) for given `(class, name, user)` keys so as
+to avoid querying the XPA name server for each request.  Entries expire after
+`cache.ttl` seconds (caching is disabled if `cache.ttl ≤ 0`).  Fields
+`cache.hits` and `cache.misses` count the number of successful and failed
+look-ups in the cache.  The cache also keeps the list of all access points
+known by the name server which is used to resolve the access points of
+requests with keyword `users`.  The cache used by [`XPA.find`](@ref) is given
+by [`XPA.namecache()`](@ref).
+
+"""
+mutable struct NameCache
+    lock::ReentrantLock
+    entries::Dict{NTuple{3,String},Tuple{AccessPoint,Float64}}
+    listing::Vector{AccessPoint} # all access points known by the name server
+    index::NameIndex             # index of `listing`
+    expires::Float64             # expiration time of `listing`
+    ttl::Float64  # time to live for entries (in seconds)
+    hits::Int     # number of successful look-ups
+    misses::Int   # number of failed look-ups
+    NameCache(ttl::Real = 30.0) =
+        new(ReentrantLock(), Dict{NTuple{3,String},Tuple{AccessPoint,Float64}}(),
+            AccessPoint[], NameIndex(), 0.0, ttl, 0, 0)
+end
+
 # Access mode bits in AccessPoint.
 const SET    = UInt(1)
 const GET    = UInt(2)
@@ -180,6 +466,57 @@ const ACCESS = UInt(4)
 
 """
 
+An instance of the mutable structure `XPA.Histogram` counts durations (in
+nanoseconds) in logarithmic bins: `hist.counts[k]` is the number of durations
+`t` such that `2^(k-2) ≤ t < 2^(k-1)` (`hist.counts[1]` counts null
+durations).
+
+"""
+mutable struct Histogram
+    counts::Vector{Int}
+    Histogram() = new(zeros(Int, 65))
+end
+
+"""
+
+An instance of the mutable structure `XPA.RequestStats` collects the
+statistics of the requests for a given access point (or server) and command
+when instrumentation is enabled, see [`XPA.instrument!`](@ref).  All
+durations are in nanoseconds.
+
+"""
+mutable struct RequestStats
+    count::Int            # number of requests
+    errors::Int           # number of errors
+    bytes_in::Int         # number of bytes received
+    bytes_out::Int        # number of bytes sent
+    lookup_time::UInt64   # time spent in querying the name server
+    request_time::UInt64  # time spent in the XPA library (client side)
+    callback_time::UInt64 # time spent in the callbacks (server side)
+    latency::Histogram    # distribution of request/callback times
+    RequestStats() = new(0, 0, 0, 0, 0, 0, 0, Histogram())
+end
+
+"""
+
+An instance of the structure `XPA.Config` stores the values of the
+configuration parameters of XPA, see [`XPA.config`](@ref) and
+[`XPA.getconfig`](@ref).
+
+"""
+struct Config
+    maxhosts::Int         # XPA_MAXHOSTS
+    short_timeout::Int    # XPA_SHORT_TIMEOUT (in seconds)
+    long_timeout::Int     # XPA_LONG_TIMEOUT (in seconds)
+    connect_timeout::Int  # XPA_CONNECT_TIMEOUT (in seconds)
+    tmpdir::String        # XPA_TMPDIR
+    verbosity::Int        # XPA_VERBOSITY (0 for none)
+    iocallsxpa::Bool      # XPA_IOCALLSXPA
+    maxabandoned::Int     # XPA_MAXABANDONED (specific to XPA.jl)
+end
+
+"""
+
 `XPA.NullBuffer` is a singleton type representing a NULL-buffer when sending
 data to a server.
 
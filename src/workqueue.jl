@@ -0,0 +1,186 @@
+#
+# workqueue.jl --
+#
+# Implement processing of XPA set requests by worker tasks.
+#
+#------------------------------------------------------------------------------
+#
+# This file is part of XPA.jl released under the MIT "expat" license.
+# Copyright (C) 2016-2020, Éric Thiébaut (https://github.com/JuliaAstro/XPA.jl).
+#
+
+"""
+```julia
+XPA.WorkQueue(func; workers=Threads.nthreads(), capacity=64, ack=:enqueue) -> q
+```
+
+yields an object `q` which can be used in place of the function `func` of a
+receive callback so that the data received by [`XPA.set`](@ref) requests are
+processed by `workers` tasks (spawned on any Julia thread) instead of by the
+thread polling for XPA requests.  Thus slow processing of received data does
+not block the other access points of the process.  For example:
+
+```julia
+q = XPA.WorkQueue(rfunc; workers=4)
+srv = XPA.Server(class, name, help, send, XPA.ReceiveCallback(q, rdata))
+```
+
+Function `func` is called as `func(rdata, srv, params, buf)`, as any receive
+callback function, by one of the workers.  The received data in `buf` is
+handed to the worker without being copied and is freed when `func` returns.
+
+Keyword `capacity` specifies the maximum number of pending requests.  Requests
+received while the queue is full are dropped and an error is returned to the
+client.
+
+Keyword `ack` specifies when the client is acknowledged:
+
+- If `ack=:enqueue`, the callback returns [`XPA.SUCCESS`](@ref) as soon as the
+  request has been queued.  The status returned by `func` is not transmitted
+  to the client and, as the request has been completed, `func` shall not call
+  [`XPA.message`](@ref) or `error(srv,...)`.
+
+- If `ack=:completion`, the task serving the request waits until `func`
+  returns and its status is transmitted to the client.  Other Julia tasks,
+  including the workers, may run on the thread of the serving task in the
+  meantime, but no other XPA requests are processed by this process (the
+  serving task keeps the lock of the XPA library).  With a single Julia
+  thread, `func` is directly called.
+
+The following statistics are available:
+
+```julia
+length(q)       # number of pending requests
+q.processed[]   # number of successfully processed requests
+q.failed[]      # number of failed requests
+q.dropped[]     # number of requests dropped because the queue was full
+```
+
+Call `close(q)` to stop the workers once the pending requests have been
+processed.
+
+To process XPA requests in a single thread while workers run in others, see
+[`XPA.watch`](@ref).
+
+See also [`XPA.ReceiveCallback`](@ref) and [`XPA.Server`](@ref).
+
+"""
+function WorkQueue(func::F;
+                   workers::Integer = Threads.nthreads(),
+                   capacity::Integer = 64,
+                   ack::Symbol = :enqueue) where {F<:Function}
+    ack ∈ (:enqueue, :completion) ||
+        throw(ArgumentError("keyword `ack` must be `:enqueue` or `:completion`"))
+    workers ≥ 1 || throw(ArgumentError("number of workers must be at least 1"))
+    capacity ≥ 1 || throw(ArgumentError("capacity must be at least 1"))
+    q = WorkQueue{F}(func, ack, capacity, Any[], Threads.Condition(), true,
+                     Task[], Threads.Atomic{Int}(0), Threads.Atomic{Int}(0),
+                     Threads.Atomic{Int}(0))
+    for i in 1:workers
+        push!(q.workers, Threads.@spawn _work(q))
+    end
+    return q
+end
+
+# A job, it owns the buffer of received data.  For the `:completion`
+# acknowledgement mode, the status is put in `status` by the worker.
+struct _Job
+    data::Any
+    srv::Server
+    params::String
+    ptr::Ptr{Byte}
+    len::Int
+    status::Union{Nothing,Channel{Cint}}
+end
+
+# Called by `_recv` as the function of a receive callback.
+function (q::WorkQueue)(data, srv::Server, params::String, buf::ReceiveBuffer)
+    if q.ack === :completion && Threads.nthreads() == 1
+        return _call(q, data, srv, params, buf)
+    end
+    status = (q.ack === :completion ? Channel{Cint}(1) : nothing)
+    lock(q.cond)
+    try
+        if !q.open || length(q.jobs) ≥ q.capacity
+            Threads.atomic_add!(q.dropped, 1)
+            return error(srv, (q.open ? "too many pending requests" :
+                               "server is not accepting requests"))
+        end
+        # Steal the data buffer from XPA, it will be freed by the worker.
+        ptr, len = pointer(buf), sizeof(buf)
+        if ptr != NULL
+            _set_comm_buf(srv, NULL)
+            _set_comm_len(srv, 0)
+        end
+        push!(q.jobs, _Job(data, Server(srv.ptr), params, ptr, len, status))
+        notify(q.cond; all=false)
+    finally
+        unlock(q.cond)
+    end
+    status === nothing && return SUCCESS
+    # Block until the worker has completed the job.  This lets the worker run
+    # on the current thread and the garbage collector run meanwhile.  Other
+    # tasks cannot process XPA requests as `_XPA_LOCK` is held by the current
+    # task.
+    return take!(status)
+end
+
+function _work(q::WorkQueue)
+    while true
+        job = nothing
+        lock(q.cond)
+        try
+            while q.open && isempty(q.jobs)
+                wait(q.cond)
+            end
+            isempty(q.jobs) || (job = popfirst!(q.jobs))
+        finally
+            unlock(q.cond)
+        end
+        job === nothing && break
+        status = FAILURE
+        try
+            status = _call(q, job.data, job.srv, job.params,
+                           ReceiveBuffer(job.ptr, job.len))
+        finally
+            _free(job.ptr)
+            job.status === nothing || put!(job.status, status)
+        end
+    end
+    return nothing
+end
+
+function _call(q::WorkQueue, data, srv::Server, params::String,
+               buf::ReceiveBuffer)
+    status = try
+        convert(Cint, q.func(data, srv, params, buf))
+    catch err
+        @error "error while processing XPA request" params exception=err
+        FAILURE
+    end
+    Threads.atomic_add!((status == SUCCESS ? q.processed : q.failed), 1)
+    return status
+end
+
+Base.length(q::WorkQueue) = length(q.jobs)
+
+Base.isopen(q::WorkQueue) = q.open
+
+function Base.close(q::WorkQueue)
+    lock(q.cond)
+    try
+        q.open = false
+        notify(q.cond; all=true)
+    finally
+        unlock(q.cond)
+    end
+    return nothing
+end
+
+function Base.show(io::IO, q::WorkQueue)
+    print(io, "XPA.WorkQueue(", length(q.workers), " worker",
+          (length(q.workers) > 1 ? "s" : ""), ", ack = :", q.ack,
+          ", pending = ", length(q), "/", q.capacity,
+          ", processed = ", q.processed[], ", failed = ", q.failed[],
+          ", dropped = ", q.dropped[], ")")
+end
@@ -10,7 +10,7 @@
 #
 module XPATests
 
-using XPA
+using XPA, Test
 import Base: RefValue
 
 const VERBOSE = true
@@ -92,4 +92,886 @@ function main2()
     XPA.mainloop()
 end
 
+function recycle_reply(nmax::Int)
+    rep = XPA._acquire_reply(nmax)
+    XPA.release!(rep)
+    return nothing
+end
+
+@testset "Reply pool" begin
+    rep = XPA._acquire_reply(3)
+    @test length(rep) == 0
+    XPA.release!(rep)
+    XPA.release!(rep) # releasing twice must not pool `rep` twice
+    @test XPA._acquire_reply(3) === rep
+    @test XPA._acquire_reply(3) !== rep
+    # Only the pool is checked here, not the whole request path.
+    recycle_reply(1) # warm up
+    @test (@allocated recycle_reply(1)) == 0
+end
+
+# Call `f(buf)` with a send buffer initially holding the `len` bytes of the
+# malloc'ed buffer at `ptr` (nothing by default) and yield the address and
+# the size of the contents of the send buffer.
+function send_buffer(f::Function, ptr::Ptr{UInt8} = Ptr{UInt8}(0),
+                     len::Integer = 0)
+    bufptr, lenptr = Ref(ptr), Ref{Csize_t}(len)
+    GC.@preserve bufptr lenptr begin
+        f(XPA.SendBuffer(Base.unsafe_convert(Ptr{Ptr{UInt8}}, bufptr),
+                         Base.unsafe_convert(Ptr{Csize_t}, lenptr),
+                         C_NULL))
+    end
+    return bufptr[], Int(lenptr[])
+end
+
+# Build a reply as filled by the XPA library.  Each answer is specified by a
+# tuple `(data, server, message)` whose parts are `nothing` if missing or a
+# string.  The data may also be a pair `(ptr, len)` of a malloc'ed buffer
+# which is owned by the reply.
+function make_reply(answers::Tuple...; nmax::Integer = length(answers))
+    rep = XPA._new_reply(nmax)
+    rep.replies = length(answers)
+    for (i, (data, server, message)) in enumerate(answers)
+        if data isa String
+            rep.buffers[i], rep.lengths[i] = XPA._strdup(data), sizeof(data)
+        elseif data !== nothing
+            rep.buffers[i], rep.lengths[i] = data
+        end
+        server === nothing || (rep.buffers[i + nmax] = XPA._strdup(server))
+        message === nothing || (rep.buffers[i + 2nmax] = XPA._strdup(message))
+    end
+    return rep
+end
+
+@testset "Commands" begin
+    cmds = XPA.Commands(
+        "version" => (send = (_, srv, args, buf) -> (XPA.store!(buf, "1.0");
+                                                     XPA.SUCCESS),
+                      help = "get version"),
+        "quit" => (recv = (_, srv, args, buf) -> XPA.SUCCESS,))
+    @test length(cmds) == 2
+    @test haskey(cmds, "quit") && !haskey(cmds, "qui")
+    @test_throws ArgumentError XPA.Commands("a" => (send = identity,),
+                                            "a" => (send = identity,))
+    params = "  quit now  please"
+    GC.@preserve params begin
+        verb, args = XPA._split_command(pointer(params))
+        @test verb == "quit" && args == "now  please"
+        @test isa(args, XPA.StringView) && String(args) == "now  please"
+        @test XPA._lookup(cmds, verb) == 2
+        @test (@allocated XPA._lookup(cmds, verb)) == 0
+    end
+    @test XPA.StringView(Ptr{UInt8}(0)) == ""
+end
+
+# Store `arr` as a framed array in the answer of a reply.
+framed_reply(arr::AbstractArray) =
+    make_reply((send_buffer(buf -> XPA.store!(buf, arr; framed=true)),
+                nothing, nothing))
+
+@testset "Framed arrays" begin
+    A = reshape(Int32(1):Int32(24), 2, 3, 4)
+    B = XPA.get_data(Array, framed_reply(A))
+    @test isa(B, Array{Int32,3}) && B == A
+    rep = framed_reply(view(collect(A), 2, :, 2:3))
+    @test XPA.get_data(Array{Int32}, rep; preserve=true) == A[2, :, 2:3]
+    @test_throws ErrorException XPA.get_data(Array{Float32}, rep)
+    # Pretend the array was sent with the other byte order.
+    ptr = rep.buffers[1]
+    unsafe_store!(ptr, (unsafe_load(ptr, 5) == UInt8('L') ?
+                        UInt8('B') : UInt8('L')), 5)
+    for i in 1:2
+        p = Ptr{Int64}(ptr + 8*i)
+        unsafe_store!(p, bswap(unsafe_load(p)))
+    end
+    XPA.bswap!(unsafe_wrap(Array, Ptr{Int32}(ptr + 24), 6))
+    @test XPA.get_data(Array, rep) == A[2, :, 2:3]
+    @test XPA.bswap!([0x0102, 0x0304]) == [0x0201, 0x0403]
+    # Dimensions whose product overflows and unknown flags are rejected.
+    rep = framed_reply(zeros(UInt8, 2, 2))
+    ptr = rep.buffers[1]
+    for d in 1:2
+        unsafe_store!(Ptr{Int64}(ptr + 8*d), typemax(Int64) ÷ 2)
+    end
+    @test_throws ErrorException XPA.get_data(Array, rep)
+    rep = framed_reply(zeros(UInt8, 2, 2))
+    unsafe_store!(rep.buffers[1], 0x01, 8)
+    @test_throws ErrorException XPA.get_data(Array, rep)
+end
+
+function roundtrip(data::Vector{UInt8})
+    zptr, zlen = XPA._compress(pointer(data), sizeof(data))
+    zptr == C_NULL && return nothing
+    try
+        XPA._is_compressed(zptr, zlen) || return nothing
+        ptr, len = XPA._decompress(zptr, zlen)
+        return unsafe_wrap(Array, ptr, len, own=true)
+    finally
+        XPA._free(zptr)
+    end
+end
+
+@testset "Compression" begin
+    for data in (zeros(UInt8, 5000),
+                 collect(reinterpret(UInt8, [round(Int16, 100*sin(i/500))
+                                             for i in 1:3000])),
+                 repeat(UInt8[1:200...], 12000)) # several chunks
+        @test roundtrip(data) == data
+    end
+    @test roundtrip(rand(UInt8, 5000)) === nothing # incompressible
+    @test roundtrip(zeros(UInt8, 100)) === nothing # too small
+    params, other = "@xpa.jl:shm,lz4  zoom 2", "zoom"
+    GC.@preserve params other begin
+        opts, ptr = XPA._request_options(pointer(params))
+        @test opts == XPA._OPTION_LZ4 && unsafe_string(ptr) == "zoom 2"
+        opts, ptr = XPA._request_options(pointer(other))
+    end
+    @test opts == 0
+end
+
+@testset "Answers" begin
+    rep = make_reply((nothing, "TEST:srv1", nothing),
+                     (nothing, "TEST:srv2", "XPA\$MESSAGE hello"),
+                     (nothing, "TEST:srv3", "XPA\$ERROR oops"))
+    @test [a.index for a in rep] == [1, 2, 3]
+    @test rep[2].server == "TEST:srv2" && rep[3].message == "XPA\$ERROR oops"
+    @test isempty(rep[1].message) && sizeof(rep[1].data) == 0
+    @test map(XPA.has_error, rep) == [false, false, true]
+    @test map(XPA.has_message, rep) == [false, true, false]
+    @test XPA.classify(rep) == (BitSet(1), BitSet(2), BitSet(3))
+    @test XPA.has_errors(rep)
+    @test_throws BoundsError rep[4]
+    ok, msgs, errs = BitSet(), BitSet(), BitSet()
+    XPA.classify!(ok, msgs, errs, rep) # warm up
+    @test (@allocated XPA.classify!(ok, msgs, errs, rep)) == 0
+end
+
+@testset "Instrumentation" begin
+    hist = XPA.Histogram()
+    foreach(t -> push!(hist, t), (0, 1, 3, 1000))
+    @test hist.counts[1:3] == [1, 1, 1] && hist.counts[11] == 1
+    @test sum(hist) == 4
+    @test XPA._verb("@xpa.jl:lz4 zoom to 2") == "zoom"
+    @test XPA._verb("  ") == ""
+    @test !XPA.isinstrumented()
+    XPA.instrument!(true)
+    @test XPA.isinstrumented()
+    XPA._record_lookup!("DS9:ds9", UInt64(1000))
+    @test XPA.stats()[(:client, "DS9:ds9", "")].lookup_time == 1000
+    XPA.reset_stats!()
+    @test isempty(XPA.stats())
+    XPA.instrument!(false)
+    @test !XPA.isinstrumented()
+end
+
+@testset "Users" begin
+    @test XPA._matches("*", "anything")
+    @test XPA._matches("ds?", "DS9") && XPA._matches("d*9", "ds9")
+    @test !XPA._matches("ds?", "ds10") && !XPA._matches("", "x")
+    @test XPA._is_address("7f000001:43021") && !XPA._is_address("DS9:ds9")
+    parts = [make_reply((nothing, "TEST:srv$i", nothing)) for i in 1:2]
+    rep = XPA._merge!(XPA._new_reply(3), parts)
+    @test length(rep) == 2 && [a.server for a in rep] == ["TEST:srv1", "TEST:srv2"]
+    @test all(part -> length(part) == 0 && part.buffers[2] == C_NULL, parts)
+end
+
+@testset "Published" begin
+    pub = XPA.Published()
+    @test XPA.version(pub) == 0 && length(pub.buffer) == XPA._PUBLISHED_HEADER
+    data = UInt8[1, 2, 3]
+    @test XPA.publish!(pub, data) === pub
+    prev = pub.buffer
+    XPA.publish!(pub, "hello")
+    @test XPA.version(pub) == 2 && prev[XPA._PUBLISHED_HEADER+1:end] == data
+    @test String(pub.buffer[XPA._PUBLISHED_HEADER+1:end]) == "hello"
+    @test XPA._published_version(pointer(pub.buffer), length(pub.buffer)) == 2
+    @test_throws ErrorException XPA._published_version(pointer(data), 3)
+end
+
+@testset "Batch" begin
+    b = XPA.Batch(XPA.Client(C_NULL), "7f000001:43021", String[], Any[])
+    data = [1.0, 2.0]
+    @test XPA.set(b, "zoom", 2) === b
+    XPA.set(b, "array"; data = data)
+    XPA.set(b, "file"; data = IOBuffer("abc"))
+    @test length(b) == 3 && b.params == ["zoom 2", "array", "file"]
+    @test b.data[2] === data && b.data[3] == UInt8[0x61, 0x62, 0x63]
+    @test sizeof(b.data[1]) == 0
+end
+
+@testset "Targets" begin
+    apt = XPA.AccessPoint("DS9", "ds9", "7f000001:43021", "nobody", XPA.GET)
+    h = XPA.Target(XPA.Client(C_NULL), "DS9:ds9", "*", "", apt)
+    @test XPA.address(h) == "7f000001:43021"
+    @test repr(h) == "XPA.Target(\"DS9:ds9\" => \"7f000001:43021\")"
+    # An error answered by the server does not resolve the access point
+    # again (which would query the name server) nor replay the request.
+    calls = Ref(0)
+    rep = XPA._retarget(h, false) do addr
+        calls[] += 1
+        make_reply((nothing, addr, "XPA\$ERROR invalid command"))
+    end
+    @test calls[] == 1 && XPA.has_error(rep, 1)
+    XPA.release!(rep)
+end
+
+@testset "Server registry" begin
+    ptr = Ptr{Cvoid}(UInt(0x1234))
+    @test XPA._root!(ptr, (nothing, nothing)) === nothing
+    @test haskey(XPA._SERVERS, ptr)
+    pop!(XPA._SERVERS, ptr)
+    @test 8*sizeof(XPA._FDSET) == XPA._FD_SETSIZE
+end
+
+@testset "Shared memory" begin
+    str = XPA._options_prefix(XPA._OPTION_LZ4 | XPA._OPTION_SHM)*"cmd"
+    opts, ptr = XPA._request_options(pointer(str))
+    @test opts == XPA._OPTION_LZ4 | XPA._OPTION_SHM
+    @test unsafe_string(ptr) == "cmd"
+    data = rand(UInt8, XPA._SHM_MINSIZE)
+    ptr = XPA._memcpy!(XPA._malloc(length(data)), pointer(data), length(data))
+    rep = make_reply((send_buffer(ptr, length(data)) do buf
+                          @test XPA._export_shared!(buf)
+                      end, nothing, nothing))
+    XPA._map_shared!(rep)
+    @test XPA._mapping(rep, 1) !== nothing
+    @test XPA.get_data(Vector{UInt8}, rep; preserve = true) == data
+    arr = XPA.get_data(Vector{UInt8}, rep)
+    @test arr == data && XPA._mapping(rep, 1) === nothing
+    XPA.release!(rep)
+    # Files of descriptors which are not mapped are deleted, but only if
+    # shared memory has been requested.
+    shared_path(ptr, len) = unsafe_string(ptr + XPA._SHM_HEADER,
+                                          len - XPA._SHM_HEADER)
+    export_data() = send_buffer(XPA._memcpy!(XPA._malloc(length(data)),
+                                             pointer(data), length(data)),
+                                length(data)) do buf
+        @test XPA._export_shared!(buf)
+    end
+    rep = make_reply((export_data(), nothing, nothing))
+    path = shared_path(rep.buffers[1], rep.lengths[1])
+    @test isfile(path) && !rep.shared
+    XPA.release!(rep)
+    @test isfile(path)
+    rm(path)
+    rep = make_reply((export_data(), nothing, nothing))
+    path = shared_path(rep.buffers[1], rep.lengths[1])
+    rep.shared = true
+    XPA.release!(rep)
+    @test !ispath(path) && !rep.shared
+    ptr, len = export_data()
+    path = shared_path(ptr, len)
+    XPA._free(ptr)
+    @test XPA.cleanup_shared(3600) == 0 && isfile(path)
+    @test XPA.cleanup_shared() == 1 && !ispath(path)
+end
+
+@testset "In-place get" begin
+    A = reshape(Int32(1):Int32(6), 2, 3)
+    rep = framed_reply(A)
+    dest = zeros(Int32, 2, 3)
+    @test XPA.get_data!(dest, rep; framed = true) === dest && dest == A
+    @test_throws ErrorException XPA.get_data!(zeros(Int32, 3, 2), rep;
+                                              framed = true)
+    @test_throws ErrorException XPA.get_data!(zeros(Float32, 2, 3), rep;
+                                              framed = true)
+    # Without framing, the header is part of the data.
+    hdr = zeros(UInt8, 8)
+    @test XPA.get_data!(hdr, rep) == UInt8['X', 'P', 'A', 'A',
+                                          XPA._FRAME_NATIVE_ENDIAN, 6, 2, 0]
+    @test_throws ErrorException XPA.get_data!(zeros(UInt8, 100), rep)
+    XPA.release!(rep)
+end
+
+@testset "Polling" begin
+    # Polling blocks until the timeout, without holding the lock of the XPA
+    # library and without waking up in the meantime.
+    t0 = time()
+    @test XPA.poll(0.2, 1) == 0
+    @test time() - t0 ≥ 0.19 && !islocked(XPA._XPA_LOCK)
+    @test XPA._WAKE_PIPE[1] ≥ 0 && XPA._POLLERS[] == 0
+    # A polling thread is woken when the set of servers changes.
+    pfds, fds = XPA._PollFD[], XPA._SocketKey[]
+    Threads.atomic_add!(XPA._POLLERS, 1)
+    try
+        XPA._wake_pollers()
+    finally
+        Threads.atomic_sub!(XPA._POLLERS, 1)
+    end
+    @test XPA._wait_sockets!(pfds, fds, 5000)
+    @test !XPA._wait_sockets!(pfds, fds, 0)
+    if Threads.nthreads() > 1
+        task = Threads.@spawn XPA._poll(10_000, Cint(1), true)
+        @test timedwait(() -> XPA._POLLERS[] > 0, 5.0) === :ok
+        @test !islocked(XPA._XPA_LOCK)
+        XPA._notify_watchers()
+        @test timedwait(() -> istaskdone(task), 5.0) === :ok
+        @test fetch(task) == 0
+    end
+end
+
+@testset "Asynchronous requests" begin
+    # A request whose task yields a reply once `go` is ready.
+    function request(go::Channel{Nothing})
+        task = @async (take!(go); make_reply(("ok", "XPATEST:a x", nothing)))
+        return XPA.Request(task, Threads.Atomic{Bool}(false))
+    end
+    go = Channel{Nothing}(1)
+    req = request(go)
+    @test !isready(req) && !XPA.iscancelled(req)
+    @test sprint(show, req) == "XPA.Request(running)"
+    put!(go, nothing)
+    rep = fetch(req)
+    @test isready(req) && sprint(show, req) == "XPA.Request(done)"
+    @test XPA.get_data(String, rep) == "ok"
+    XPA.release!(rep)
+    # A cancelled request cannot be fetched, whether it completes before or
+    # after being cancelled.
+    req = request(go)
+    XPA.cancel!(req)
+    @test XPA.iscancelled(req) && sprint(show, req) == "XPA.Request(cancelled)"
+    @test_throws ErrorException fetch(req)
+    put!(go, nothing)
+    wait(req)
+    @test_throws ErrorException fetch(req)
+    req = request(go)
+    put!(go, nothing)
+    wait(req)
+    XPA.cancel!(req)
+    @test_throws ErrorException fetch(req)
+end
+
+@testset "Connections" begin
+    # Each task has its own connection, which is re-open if closed.
+    conn = XPA.connection()
+    @test isopen(conn) && XPA.connection() === conn
+    other = fetch(@async XPA.connection())
+    @test other !== conn && isopen(other)
+    close(conn)
+    @test XPA.connection() === conn && isopen(conn)
+end
+
+@testset "Receive streams" begin
+    # The data socket is replaced by a file larger than the internal buffer
+    # of the stream.
+    data = rand(UInt8, 100_000)
+    path = tempname()
+    write(path, data)
+    fd = ccall(:open, Cint, (Cstring, Cint), path, 0) # O_RDONLY
+    @test fd ≥ 0
+    try
+        io = XPA.ReceiveStream(fd, 1000)
+        @test !eof(io) && bytesavailable(io) == 65536
+        @test read(io, UInt8) == data[1]
+        buf = Vector{UInt8}(undef, 90_000)
+        @test read!(io, buf) === buf && buf == data[2:90_001]
+        @test readavailable(io) == data[90_002:end]
+        @test eof(io) && !isopen(io)
+        @test_throws EOFError read(io, UInt8)
+    finally
+        ccall(:close, Cint, (Cint,), fd)
+        rm(path)
+    end
+    @test eof(XPA.ReceiveStream(-1, 1000))
+end
+
+@testset "Work queue" begin
+    # With `ack=:completion`, the serving task waits for the job to be
+    # processed by a worker which may run on the same thread and which lets
+    # the garbage collector run.
+    q = XPA.WorkQueue(workers = 2, ack = :completion) do data, srv, params, buf
+        GC.gc()
+        return (params == "ok" ? XPA.SUCCESS : XPA.FAILURE)
+    end
+    srv, buf = XPA.Server(C_NULL), XPA.ReceiveBuffer(Ptr{UInt8}(0), 0)
+    @test all(i -> q(nothing, srv, "ok", buf) == XPA.SUCCESS, 1:20)
+    @test q(nothing, srv, "bad", buf) == XPA.FAILURE
+    @test q.processed[] == 20 && q.failed[] == 1
+    close(q)
+    foreach(wait, q.workers)
+    @test !isopen(q) && length(q) == 0
+end
+
+@testset "Configuration" begin
+    @test XPA.getconfig("XPA_MAXHOSTS") == XPA.config().maxhosts
+    @test XPA.getconfig(:XPA_TMPDIR) isa String
+    old = XPA.setconfig!("XPA_MAXHOSTS", 7)
+    @test XPA._nmax(-1) == 7 && ENV["XPA_MAXHOSTS"] == "7"
+    @test XPA.setconfig!("XPA_MAXHOSTS", old) == 7
+    @test XPA._parse_config(Bool, "0") === false
+    @test XPA._parse_config(Bool, "yes") === true
+    @test XPA._parse_config(Int, "x") === nothing
+    old = XPA.setconfig!("XPA_VERBOSITY", 2)
+    @test XPA.config().verbosity === 2
+    XPA.setconfig!("XPA_VERBOSITY", false)
+    @test XPA.getconfig("XPA_VERBOSITY") === 0
+    XPA.setconfig!("XPA_VERBOSITY", old)
+    @test XPA._parse_verbosity("yes") === 1
+    @test XPA._parse_verbosity("x") === nothing
+    @test_throws ErrorException XPA.setconfig!("XPA_VERBOSITY", "loud")
+    @test_throws ErrorException XPA.getconfig("XPA_FOO")
+    old = XPA.setconfig!("XPA_MAXABANDONED", 5)
+    @test XPA.config().maxabandoned == 5
+    XPA.setconfig!("XPA_MAXABANDONED", old)
+    @test XPA._default_maxabandoned() ≥ 1
+end
+
+@testset "Health" begin
+    apt = "TEST:health"
+    @test XPA.health(apt).failures == 0
+    for n in 1:XPA._BREAKER_THRESHOLD
+        # The health is shared by all client connections.
+        rep = XPA._error_reply(apt, "request timed out")
+        @test XPA._track!(XPA.Client(C_NULL), apt, rep, 1, false) == false
+        @test XPA.health(apt).failures == n
+        XPA.release!(rep)
+    end
+    @test XPA.health(apt).retry_at > time()
+    @test XPA._fail_fast(apt)
+    rep = XPA._circuit_reply(apt)
+    @test XPA.has_error(rep, 1)
+    XPA.release!(rep)
+    # When the delay has elapsed, a single request is let through without
+    # probing the server.
+    XPA._HEALTH[apt].retry_at = 0.0
+    @test !XPA._fail_fast(apt) && XPA._fail_fast(apt)
+    @test XPA.health(apt).failures == XPA._BREAKER_THRESHOLD
+    # Requests with a deadline, sent through the connection pool, fail fast.
+    rep = XPA.get(apt, "cmd"; timeout = 5)
+    @test occursin("not responding", XPA.get_message(rep, 1))
+    XPA.release!(rep)
+    @test XPA.reset_health!(apt) === nothing
+    @test !XPA._fail_fast(apt)
+    # Only connection errors are failures of the access point.
+    for msg in ("invalid command", "timeout reading camera",
+                "no response from camera")
+        rep = make_reply((nothing, apt, "XPA\$ERROR "*msg))
+        @test !XPA._failed(rep, 1) && XPA._failed(rep, 0)
+        XPA.release!(rep)
+    end
+    rep = make_reply((nothing, apt, "XPA\$ERROR no response from server " *
+                      "within 10 sec (TEST:health)"))
+    @test XPA._failed(rep, 1)
+    XPA.release!(rep)
+end
+
+@testset "Deadlines" begin
+    @test XPA._deadline(Inf, Inf) == Inf
+    @test XPA._deadline(Inf, 1.0) == 1.0
+    @test XPA._deadline(0.0, Inf) ≤ time()
+    @test XPA._deadline(1e3, 2.0) == 2.0
+    @test_throws ArgumentError XPA._deadline(-1, Inf)
+    # A request whose deadline has passed is not sent.
+    rep = XPA.get("TEST:nowhere"; deadline = time() - 1)
+    @test length(rep) == 1 && XPA.has_error(rep, 1)
+    @test occursin("timed out", XPA.get_message(rep, 1))
+    XPA.release!(rep)
+    @test_throws ErrorException XPA.set("TEST:nowhere"; timeout = 0,
+                                        throwerrors = true)
+    # The same keywords are accepted when writing the data to a stream.
+    io = IOBuffer()
+    rep = XPA.get(io, "TEST:nowhere"; deadline = time() - 1,
+                  compress = true, shm = true)
+    @test occursin("timed out", XPA.get_message(rep, 1)) && position(io) == 0
+    XPA.release!(rep)
+    # Requests fail fast while too many abandoned requests are running.
+    Threads.atomic_add!(XPA._ABANDONED, XPA.config().maxabandoned)
+    try
+        rep = XPA.get("TEST:nowhere"; timeout = 10)
+        @test occursin("too many abandoned", XPA.get_message(rep, 1))
+        XPA.release!(rep)
+    finally
+        Threads.atomic_sub!(XPA._ABANDONED, XPA.config().maxabandoned)
+    end
+end
+
+@testset "Response cache" begin
+    calls = Ref(0)
+    cb = XPA.SendCallback(calls; cache = 64) do calls, srv, params, buf
+        calls[] += 1
+        XPA.store!(buf, "answer to "*params)
+        return XPA.SUCCESS
+    end
+    cache = XPA.responsecache(cb)
+    @test cache isa XPA.ResponseCache && cache.maxbytes == 64
+    @test XPA.responsecache(XPA.SendCallback((args...) -> XPA.SUCCESS)) === nothing
+    ptr, len = send_buffer() do buf
+        @test XPA._send_cached(cb, cache, XPA.Server(C_NULL), "wcs",
+                               buf) == XPA.SUCCESS
+    end
+    XPA._free(ptr)
+    @test calls[] == 1 && cache.misses == 1 && length(cache) == 1
+    @test String(copy(XPA._lookup(cache, "wcs"))) == "answer to wcs"
+    @test cache.hits == 1
+    # Least recently used answers are evicted.
+    XPA._remember!(cache, "a", zeros(UInt8, 20))
+    XPA._lookup(cache, "wcs")
+    XPA._remember!(cache, "b", zeros(UInt8, 30))
+    @test XPA._lookup(cache, "a") === nothing && cache.evictions == 1
+    @test XPA._lookup(cache, "wcs") !== nothing && cache.bytes ≤ 64
+    @test XPA.invalidate_response!(cb, "wcs") === cb &&
+        XPA._lookup(cache, "wcs") === nothing
+    @test XPA.invalidate_response!(cb) === cb && length(cache) == 0 &&
+        cache.bytes == 0
+    # The name cache is not confused with the cache of the answers.
+    @test_throws MethodError XPA.invalidate!(cb)
+    @test_throws ArgumentError XPA.SendCallback((args...) -> XPA.SUCCESS;
+                                                cache = -1)
+end
+
+@testset "Name server listing" begin
+    str = """DS9 ds9 gs 7f000001:43021 alice
+             TEST test1 gsi 7f000001:43022 bob\r
+             TEST test1 gs 7f000001:43023 alice
+             BAD access xz 7f000001:43024 alice
+             BAD fields gs 7f000001:43025
+
+             DS9 ds9 gs 7f000001:43026 bob"""
+    scan(s) = GC.@preserve s XPA._parse_listing(pointer(s), sizeof(s))
+    lst = @test_logs (:warn,) (:warn,) scan(str)
+    @test length(lst) == 4
+    @test lst[2] == XPA.AccessPoint("TEST", "test1", "7f000001:43022", "bob",
+                                    XPA.GET|XPA.SET|XPA.INFO)
+    @test lst[1].user === lst[3].user
+    @test (@test_logs (:warn,) (:warn,) scan(str))[1].class === lst[1].class
+    idx = XPA.NameIndex(lst)
+    @test XPA._first_match(lst, idx, "TEST", "test1", "alice") === lst[3]
+    @test XPA._first_match(lst, idx, "*", "ds9", "*") === lst[1]
+    @test XPA._first_match(lst, idx, "*", "ds9", "bob") === lst[4]
+    @test XPA._first_match(lst, idx, "DS9", "test1", "*") === nothing
+    @test XPA._first_match(lst, idx, "TEST", "*", "alice") === lst[3]
+    @test XPA._first_match(lst, nothing, "*", "ds9", "bob") === lst[4]
+end
+
+@testset "Name cache" begin
+    cache = XPA.NameCache(0.2)
+    apt = XPA.AccessPoint("TEST", "cache", "7f000001:43030", "bob", XPA.GET)
+    key = ("TEST", "cache", "*")
+    @test XPA._lookup(cache, key) === nothing && cache.misses == 1
+    XPA._remember!(cache, key, apt)
+    @test XPA._lookup(cache, key) === apt && cache.hits == 1
+    sleep(0.3) # let the entry expire
+    @test XPA._lookup(cache, key) === nothing && cache.misses == 2
+    @test isempty(cache.entries)
+    cache.ttl = 30
+    XPA._remember!(cache, key, apt)
+    @test XPA.invalidate!(cache, "TEST:cache") === cache
+    @test isempty(cache.entries)
+    lst = [apt]
+    XPA._store_listing!(cache, lst, XPA.NameIndex(lst))
+    XPA._remember!(cache, key, apt)
+    @test XPA._find_listed(cache, "*", "cache", "bob") === apt
+    @test XPA.invalidate!(cache, apt) === cache
+    @test isempty(cache.entries) && isempty(cache.listing)
+    @test XPA._find_listed(cache, "*", "cache", "bob") === nothing
+    cache.ttl = 0 # caching disabled
+    XPA._remember!(cache, key, apt)
+    @test isempty(cache.entries)
+    # Only the failures to reach a server invalidate the entries of its
+    # address.
+    cache = XPA.namecache()
+    XPA._remember!(cache, key, apt)
+    rep = make_reply((nothing, apt.addr, "XPA\$ERROR invalid command"))
+    XPA._check_address(apt.addr, rep)
+    @test haskey(cache.entries, key)
+    XPA.release!(rep)
+    rep = make_reply((nothing, apt.addr, "XPA\$ERROR no response from " *
+                      "server within 10 sec (TEST:cache)"))
+    XPA._check_address(apt.addr, rep)
+    @test !haskey(cache.entries, key)
+    XPA.release!(rep)
+end
+
+@testset "Precompilation" begin
+    @test XPA._precompile() === nothing
+end
+
+@testset "Text decoders" begin
+    text_reply(str::String) = make_reply((str, nothing, nothing))
+    rep = text_reply(" 2.5\n")
+    @test XPA.get_data(Float64, rep) === 2.5
+    @test XPA.get_data(Float32, rep) === 2.5f0
+    @test_throws ErrorException XPA.get_data(Int, rep)
+    XPA.release!(rep)
+    rep = text_reply("512\t-3 +7")
+    @test XPA.get_data(NTuple{3,Int}, rep) === (512, -3, 7)
+    @test XPA.get_data(Vector{Int16}, rep; text = true) == Int16[512, -3, 7]
+    @test XPA.get_data(Vector{Float64}, rep; text = true) == [512, -3, 7]
+    @test_throws ErrorException XPA.get_data(NTuple{2,Int}, rep)
+    @test_throws ErrorException XPA.get_data(NTuple{4,Int}, rep)
+    @test_throws ErrorException XPA.get_data(Int, rep)
+    @test_throws ErrorException XPA.get_data(NTuple{3,UInt}, rep)
+    @test_throws ErrorException XPA.get_data(NTuple{3,Int8}, rep)
+    XPA.release!(rep)
+    rep = text_reply("1e3")  # last token at the end of the buffer
+    @test XPA.get_data(Float64, rep) === 1000.0
+    @test XPA.get_data(Vector{Float64}, rep; text = true) == [1000.0]
+    XPA.release!(rep)
+    rep = text_reply("")
+    @test XPA.get_data(Vector{Int}, rep; text = true) == Int[]
+    @test_throws ErrorException XPA.get_data(Float64, rep)
+    XPA.release!(rep)
+end
+
+# The following tests run servers in this process, whose requests are
+# processed by `serve` while the client requests are running asynchronously.
+# They require an XPA name server (started by the XPA library if needed).
+const LIVE = try
+    srv = XPA.Server("XPATEST", "probe", "",
+                     XPA.SendCallback((args...) -> XPA.SUCCESS), nothing)
+    try
+        XPA.find("XPATEST:probe"; cache=false) !== nothing
+    finally
+        close(srv)
+    end
+catch
+    false
+end
+LIVE || @info "No XPA name server, tests with live servers are skipped."
+
+# Process the requests to the servers of this process until the asynchronous
+# request `req` completes and yield its reply.
+function serve(req::XPA.Request; timeout::Real = 20)
+    t0 = time()
+    while !isready(req)
+        XPA.poll(0, 1)
+        sleep(0.001)
+        time() - t0 < timeout || error("timeout while serving requests")
+    end
+    return fetch(req)
+end
+
+LIVE && @testset "Round trip" begin
+    received = Int32[]
+    srv = XPA.Server("XPATEST", "roundtrip", "round trip tests",
+                     XPA.SendCallback(nothing) do _, srv, params, buf
+                         if params == "text"
+                             # Strings and arrays which are not a `String` or
+                             # a dense array can also be shared.
+                             XPA.store!(buf, SubString("a shared text", 3);
+                                        share = true)
+                         elseif params == "view"
+                             XPA.store!(buf, view(Int32[0, 1, 2, 3], 2:4);
+                                        share = true)
+                         else
+                             XPA.store!(buf, Int32[1, 2, 3])
+                         end
+                         return XPA.SUCCESS
+                     end,
+                     XPA.ReceiveCallback(nothing) do _, srv, params, buf
+                         append!(received, XPA.peek(Vector{Int32}, buf))
+                         return XPA.SUCCESS
+                     end)
+    try
+        apt = XPA.address(XPA.find("XPATEST:roundtrip"; cache=false))
+        rep = serve(XPA.get_async(apt, "data"))
+        @test length(rep) == 1 && !XPA.has_errors(rep)
+        @test XPA.get_data(Vector{Int32}, rep) == Int32[1, 2, 3]
+        XPA.release!(rep)
+        rep = serve(XPA.get_async(apt, "text"))
+        @test !XPA.has_errors(rep) && XPA.get_data(String, rep) == "shared text"
+        XPA.release!(rep)
+        rep = serve(XPA.get_async(apt, "view"))
+        @test XPA.get_data(Vector{Int32}, rep) == Int32[1, 2, 3]
+        XPA.release!(rep)
+        io = IOBuffer()
+        task = @async XPA.get(io, apt, "data"; timeout = 10)
+        while !istaskdone(task)
+            XPA.poll(0, 1)
+            sleep(0.001)
+        end
+        rep = fetch(task)
+        @test length(rep) == 1 && !XPA.has_errors(rep)
+        @test reinterpret(Int32, take!(io)) == Int32[1, 2, 3]
+        XPA.release!(rep)
+        rep = serve(XPA.set_async(apt, "data"; data = Int32[4, 5]))
+        @test length(rep) == 1 && !XPA.has_errors(rep)
+        @test received == Int32[4, 5]
+        XPA.release!(rep)
+    finally
+        close(srv)
+    end
+end
+
+LIVE && @testset "Error answers" begin
+    # Errors answered by a live server are neither failures of the access
+    # point nor a reason to send the request again.
+    calls = Ref(0)
+    srv = XPA.Server("XPATEST", "errors", "",
+                     XPA.SendCallback(nothing) do _, srv, params, buf
+                         XPA.store!(buf, "ok")
+                         return XPA.SUCCESS
+                     end,
+                     XPA.ReceiveCallback(calls) do calls, srv, params, buf
+                         calls[] += 1
+                         return error(srv, "timeout reading camera")
+                     end)
+    try
+        apt = XPA.address(XPA.find("XPATEST:errors"; cache=false))
+        pool = XPA.ConnectionPool(1)
+        rep = serve(XPA.get_async(apt; pool = pool))
+        @test !XPA.has_errors(rep)
+        XPA.release!(rep)
+        for n in 1:XPA._BREAKER_THRESHOLD + 1
+            rep = serve(XPA.set_async(apt, "cmd"; pool = pool))
+            @test calls[] == n && XPA.has_error(rep, 1)
+            @test occursin("timeout reading camera",
+                           XPA.get_message(rep, 1))
+            XPA.release!(rep)
+        end
+    finally
+        close(srv)
+    end
+end
+
+LIVE && @testset "Many requests" begin
+    # A server which is not polled does not answer, its request is abandoned
+    # at the deadline.
+    srv = XPA.Server("XPATEST", "silent", "",
+                     XPA.SendCallback((args...) -> XPA.SUCCESS), nothing)
+    try
+        apt = XPA.address(XPA.find("XPATEST:silent"; cache=false))
+        # The calls to the XPA library are serialized while the calling
+        # tasks, like this one, keep running.
+        req = XPA.get_async(apt, "data")
+        @test timedwait(() -> islocked(XPA._CLIENT_LOCK), 5.0) === :ok
+        other = XPA.get_async(apt, "data")
+        sleep(0.1)
+        @test !isready(req) && !isready(other)
+        rep = serve(req)
+        @test !XPA.has_errors(rep)
+        XPA.release!(rep)
+        XPA.release!(serve(other))
+        @test !islocked(XPA._CLIENT_LOCK)
+        t0 = time()
+        reps = XPA.getmany([apt, apt], "data"; timeout = 0.5)
+        @test time() - t0 < 5
+        @test length(reps) == 2 && all(rep -> XPA.has_error(rep, 1), reps)
+        @test all(rep -> occursin("timed out", XPA.get_message(rep, 1)), reps)
+        foreach(XPA.release!, reps)
+    finally
+        close(srv)
+    end
+    # The abandoned requests complete once the server is closed and release
+    # the lock for the next tests.
+    @test timedwait(() -> XPA._ABANDONED[] == 0, 60.0) === :ok
+end
+
+LIVE && @testset "Served commands" begin
+    cmds = XPA.Commands(
+        "version" => (send = (_, srv, args, buf) -> (XPA.store!(buf, "1.0");
+                                                     XPA.SUCCESS),),
+        "broken" => (send = (_, srv, args, buf) -> XPA.store!(buf, "1.0"),))
+    srv = XPA.Server("XPATEST", "commands", "", cmds)
+    try
+        apt = XPA.address(XPA.find("XPATEST:commands"; cache=false))
+        rep = serve(XPA.get_async(apt, "version"))
+        @test !XPA.has_errors(rep) && XPA.get_data(String, rep) == "1.0"
+        XPA.release!(rep)
+        # A function which does not return a status is an error.
+        rep = serve(XPA.get_async(apt, "broken"))
+        @test XPA.has_error(rep, 1)
+        @test occursin("instead of a status", XPA.get_message(rep, 1))
+        XPA.release!(rep)
+    finally
+        close(srv)
+    end
+end
+
+LIVE && @testset "Watcher" begin
+    srv = XPA.Server("XPATEST", "watched", "",
+                     XPA.SendCallback(nothing) do _, srv, params, buf
+                         XPA.store!(buf, params)
+                         return XPA.SUCCESS
+                     end, nothing)
+    w = XPA.watch()
+    try
+        @test isopen(w)
+        apt = XPA.address(XPA.find("XPATEST:watched"; cache=false))
+        # Successive requests open and close communication sockets whose
+        # file descriptors are likely to be reused.
+        for i in 1:5
+            req = XPA.get_async(apt, "request $i")
+            @test timedwait(() -> isready(req), 20.0) === :ok
+            rep = fetch(req)
+            @test XPA.get_data(String, rep) == "request $i"
+            XPA.release!(rep)
+        end
+        # Only sockets of live XPA structures are watched, the sockets
+        # opened and closed by the requests have been tracked without a
+        # rescan of all servers.
+        @test all(key -> key[2] != C_NULL && haskey(XPA._SERVERS, key[3]),
+                  keys(w.fds))
+        function tracked()
+            fds = XPA._SocketKey[]
+            lock(XPA._XPA_LOCK)
+            try
+                XPA._collect_fds!(fds, srv.ptr)
+            finally
+                unlock(XPA._XPA_LOCK)
+            end
+            return sort(fds) == sort(filter(key -> key[3] == srv.ptr,
+                                            collect(keys(w.fds))))
+        end
+        @test timedwait(tracked, 5.0) === :ok
+    finally
+        close(w)
+        close(srv)
+    end
+    @test !isopen(w)
+    @test timedwait(() -> istaskdone(w.task), 5.0) === :ok && isempty(w.fds)
+end
+
+# The benchmark suite is only checked on demand, with `XPA_RUN_BENCHMARKS=1`
+# and `BenchmarkTools` installed (it is not a dependency of the tests), with
+# its smallest configuration, its server being run in the project of the
+# tests.
+const BENCHMARKS = LIVE && Base.get(ENV, "XPA_RUN_BENCHMARKS", "0") == "1" &&
+    Base.find_package("BenchmarkTools") !== nothing
+if BENCHMARKS
+    withenv("XPA_BENCH_PROJECT" => Base.active_project(),
+            "XPA_BENCH_MAXSIZE" => "16",
+            "XPA_BENCH_NAPTS" => "0") do
+        include(joinpath(@__DIR__, "..", "benchmark", "benchmarks.jl"))
+    end
+end
+
+BENCHMARKS && @testset "Benchmark suite" begin
+    try
+        results = run(XPABenchmarks.SUITE; samples = 1, evals = 1,
+                      seconds = 5)
+        trials = XPABenchmarks.BenchmarkTools.leaves(results)
+        @test length(trials) == length(XPABenchmarks.BenchmarkTools.leaves(
+            XPABenchmarks.SUITE))
+        @test all(((key, trial),) -> length(trial) ≥ 1, trials)
+    finally
+        XPABenchmarks.stop_server(XPABenchmarks.PROC)
+    end
+    @test !process_running(XPABenchmarks.PROC)
+end
+
+# Likewise, the stress test, which starts a server process, is only run on
+# demand with its smallest configuration.
+const STRESS = LIVE && Base.get(ENV, "XPA_RUN_BENCHMARKS", "0") == "1"
+if STRESS
+    withenv("XPA_BENCH_PROJECT" => Base.active_project(),
+            "XPA_STRESS_SERVERS" => "1",
+            "XPA_STRESS_CLIENTS" => "1",
+            "XPA_STRESS_SIZES" => "0",
+            "XPA_STRESS_DURATION" => "0.5") do
+        include(joinpath(@__DIR__, "..", "benchmark", "stress.jl"))
+    end
+end
+
+STRESS && @testset "Stress test" begin
+    io = IOBuffer()
+    XPAStress.main(io)
+    lines = split(chomp(String(take!(io))), '\n')
+    # A line of settings, a header and a line for the only configuration.
+    @test length(lines) == 3
+    fields = split(lines[3])
+    @test parse.(Int, fields[1:3]) == [1, 1, 0]
+    @test parse(Float64, fields[end]) == 0 # percentage of errors
+end
+
 end